@@ -0,0 +1,555 @@
+/* Element handling shared by the queue backends */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "element.h"
+
+int q_compact = 0;
+int q_sso_max = 15;
+int q_intern = 0;
+unsigned long q_cmp_count = 0;
+unsigned long q_merge_cmp_count = 0;
+int q_gallop = 1;
+
+#ifdef QUEUE_KEY_PREFIX
+/* Pack the first 8 bytes of s big-endian, padding with zeros */
+static inline uint64_t key_prefix(const char *s, size_t len)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; i < 8; i++)
+        key = key << 8 | (i < len ? (unsigned char) s[i] : 0);
+    return key;
+}
+#endif
+
+/* FNV-1a hash of s, which also yields its length */
+static inline uint32_t str_hash(const char *s, size_t *len)
+{
+    uint32_t hash = 2166136261u;
+    const char *p = s;
+
+    for (; *p; p++)
+        hash = (hash ^ (unsigned char) *p) * 16777619u;
+    *len = p - s;
+    return hash;
+}
+
+/**
+ * intern_t - Interned string
+ * @refs: number of elements referring to @str
+ * @hash: hash of @str
+ * @str: the string
+ */
+typedef struct {
+    uint32_t refs;
+    uint32_t hash;
+    char str[];
+} intern_t;
+
+/* Open-addressing table of the interned strings, with linear probing. It is
+ * allocated with the first string and freed with the last one, so that no
+ * block outlives the queues.
+ */
+static intern_t **intern_table;
+static size_t intern_cap, intern_count;
+
+/* Double the table, or create it. Return false if allocation failed. */
+static bool intern_grow(void)
+{
+    size_t cap = intern_cap ? intern_cap * 2 : 64;
+    intern_t **table = malloc(cap * sizeof(intern_t *));
+    if (!table)
+        return false;
+    memset(table, 0, cap * sizeof(intern_t *));
+
+    for (size_t i = 0; i < intern_cap; i++) {
+        intern_t *in = intern_table[i];
+        if (!in)
+            continue;
+        size_t j = in->hash & (cap - 1);
+        while (table[j])
+            j = (j + 1) & (cap - 1);
+        table[j] = in;
+    }
+    free(intern_table);
+    intern_table = table;
+    intern_cap = cap;
+    return true;
+}
+
+/* Return the interned copy of s with one more reference, interning s first
+ * if needed. Return NULL if allocation failed.
+ */
+static char *intern(const char *s)
+{
+    size_t len;
+    uint32_t hash = str_hash(s, &len);
+
+    size_t i = hash & (intern_cap - 1);
+    for (; intern_cap && intern_table[i]; i = (i + 1) & (intern_cap - 1)) {
+        intern_t *in = intern_table[i];
+        if (in->hash == hash && !strcmp(in->str, s)) {
+            in->refs++;
+            return in->str;
+        }
+    }
+
+    /* Keep the load factor at or below one half */
+    if (2 * (intern_count + 1) > intern_cap) {
+        if (!intern_grow())
+            return NULL;
+        for (i = hash & (intern_cap - 1); intern_table[i];
+             i = (i + 1) & (intern_cap - 1))
+            ;
+    }
+
+    intern_t *in = malloc(sizeof(intern_t) + len + 1);
+    if (!in) {
+        /* Do not leave an empty table behind */
+        if (!intern_count) {
+            free(intern_table);
+            intern_table = NULL;
+            intern_cap = 0;
+        }
+        return NULL;
+    }
+    in->refs = 1;
+    in->hash = hash;
+    memcpy(in->str, s, len + 1);
+    intern_table[i] = in;
+    intern_count++;
+    return in->str;
+}
+
+/* Return the slot of the table holding value, or -1 if value is not an
+ * interned string. Matching addresses suffices: an interned string is only
+ * ever stored in the slots probed for its hash.
+ */
+static long intern_find(const char *value)
+{
+    if (!intern_count)
+        return -1;
+
+    size_t len;
+    uint32_t hash = str_hash(value, &len);
+    for (size_t i = hash & (intern_cap - 1); intern_table[i];
+         i = (i + 1) & (intern_cap - 1)) {
+        if (intern_table[i]->str == value)
+            return i;
+    }
+    return -1;
+}
+
+bool q_is_interned(const char *value)
+{
+    return intern_find(value) >= 0;
+}
+
+bool q_unintern(char *value)
+{
+    long slot = intern_find(value);
+    if (slot < 0)
+        return false;
+
+    intern_t *in = intern_table[slot];
+    if (--in->refs)
+        return true;
+
+    size_t mask = intern_cap - 1;
+    size_t i = slot;
+
+    /* Move back the entries whose probe sequence ran over slot i, so that
+     * lookups need no markers of deleted entries
+     */
+    for (size_t j = (i + 1) & mask; intern_table[j]; j = (j + 1) & mask) {
+        size_t home = intern_table[j]->hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            intern_table[i] = intern_table[j];
+            i = j;
+        }
+    }
+    intern_table[i] = NULL;
+    free(in);
+
+    if (!--intern_count) {
+        free(intern_table);
+        intern_table = NULL;
+        intern_cap = 0;
+    }
+    return true;
+}
+
+/* Allocate an element holding a copy of s, honoring q_intern, q_compact and
+ * q_sso_max
+ */
+element_t *element_new(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    bool sso = q_sso_max > 0 && len - 1 <= (size_t) q_sso_max;
+    element_t *e;
+
+    if (q_intern) {
+        e = malloc(sizeof(element_t));
+        if (!e)
+            return NULL;
+        e->value = intern(s);
+        if (!e->value) {
+            free(e);
+            return NULL;
+        }
+    } else if (q_compact || sso) {
+        /* Element and string bytes share one block */
+        e = malloc(sizeof(element_t) + len);
+        if (!e)
+            return NULL;
+        e->value = memcpy(e->inline_value, s, len);
+    } else {
+        e = malloc(sizeof(element_t));
+        if (!e)
+            return NULL;
+        e->value = strdup(s);
+        if (!e->value) {
+            free(e);
+            return NULL;
+        }
+    }
+#ifdef QUEUE_KEY_PREFIX
+    e->key = key_prefix(s, len);
+#endif
+    return e;
+}
+
+/* Copy the string of e to sp, truncated to at most bufsize - 1 characters */
+void element_copy_value(const element_t *e, char *sp, size_t bufsize)
+{
+    if (!sp || !bufsize)
+        return;
+
+    size_t len = strnlen(e->value, bufsize - 1);
+    memcpy(sp, e->value, len);
+    sp[len] = '\0';
+}
+
+dedup_slot_t *dedup_table_new(size_t n, size_t *cap)
+{
+    /* Keep the load factor at or below one half for short probe sequences */
+    size_t sz = 2;
+    while (sz < 2 * n)
+        sz <<= 1;
+
+    dedup_slot_t *table = test_malloc_scratch(sz * sizeof(dedup_slot_t));
+    if (!table)
+        return NULL;
+    memset(table, 0, sz * sizeof(dedup_slot_t));
+    *cap = sz;
+    return table;
+}
+
+dedup_slot_t *dedup_lookup(dedup_slot_t *table, size_t cap, element_t *e)
+{
+    size_t len;
+    uint32_t hash = str_hash(e->value, &len);
+    len &= INT32_MAX;
+
+    dedup_slot_t *slot = &table[hash & (cap - 1)];
+    for (size_t i = hash; slot->e; slot = &table[++i & (cap - 1)]) {
+        if (slot->hash == hash && slot->len == len &&
+            !strcmp(slot->e->value, e->value))
+            return slot;
+    }
+    slot->e = e;
+    slot->hash = hash;
+    slot->len = len;
+    return slot;
+}
+
+/* Sublists shorter than this are finished with insertion sort */
+#define MKQS_CUTOFF 16
+
+static inline int key_at(const element_t *e, size_t depth)
+{
+#ifdef QUEUE_KEY_PREFIX
+    if (depth < 8)
+        return (e->key >> (56 - 8 * depth)) & 0xff;
+#endif
+    return (unsigned char) e->value[depth];
+}
+
+static inline void swap_elem(element_t **a, size_t i, size_t j)
+{
+    element_t *tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+/* Sort a[0..n - 1], whose strings share their first depth bytes, by
+ * comparing the remaining suffixes
+ */
+static void suffix_insertion_sort(sort_ctx_t *ctx,
+                                  element_t **a,
+                                  size_t n,
+                                  size_t depth)
+{
+    for (size_t i = 1; i < n; i++) {
+        element_t *e = a[i];
+        size_t j = i;
+        while (j > 0) {
+            ctx->cmp_count++;
+            if (strcmp(a[j - 1]->value + depth, e->value + depth) <= 0)
+                break;
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = e;
+    }
+}
+
+/* Multikey quicksort (Bentley and Sedgewick, "Fast Algorithms for Sorting
+ * and Searching Strings", SODA 1997). a[0..n - 1] share their first depth
+ * bytes and are partitioned three ways on the byte at depth. Only the middle
+ * partition advances to the next byte, so a common prefix is examined once
+ * per partitioning step instead of once per string comparison, and keys are
+ * compared one byte at a time.
+ */
+static void mkqsort(sort_ctx_t *ctx, element_t **a, size_t n, size_t depth)
+{
+    while (n >= MKQS_CUTOFF) {
+        /* Median-of-three pivot */
+        size_t m = n / 2;
+        int x = key_at(a[0], depth), y = key_at(a[m], depth),
+            z = key_at(a[n - 1], depth);
+        if ((x <= y && y <= z) || (z <= y && y <= x))
+            swap_elem(a, 0, m);
+        else if ((y <= x && x <= z) || (z <= x && x <= y))
+            ; /* a[0] already holds the median */
+        else
+            swap_elem(a, 0, n - 1);
+        int pivot = key_at(a[0], depth);
+
+        /* a[0..lt) < pivot, a[lt..i) == pivot, a[gt..n) > pivot */
+        size_t lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            int c = key_at(a[i], depth);
+            ctx->cmp_count++;
+            if (c < pivot)
+                swap_elem(a, lt++, i++);
+            else if (c > pivot)
+                swap_elem(a, i, --gt);
+            else
+                i++;
+        }
+
+        mkqsort(ctx, a, lt, depth);
+        mkqsort(ctx, a + gt, n - gt, depth);
+        /* Strings equal up to their terminator are done */
+        if (!pivot)
+            return;
+        a += lt;
+        n = gt - lt;
+        depth++;
+    }
+    suffix_insertion_sort(ctx, a, n, depth);
+}
+
+void element_sort(sort_ctx_t *ctx, element_t **a, size_t n)
+{
+    mkqsort(ctx, a, n, 0);
+    if (!ctx->descend)
+        return;
+    for (size_t i = 0, j = n; i + 1 < j; i++)
+        swap_elem(a, i, --j);
+}
+
+/* Number of leading elements of a[0..n - 1] going before key, or that may
+ * stay before it for inclusive. Probe a[0], a[1], a[3], a[7], ... and bisect
+ * the last gap, so that finding k elements takes O(log k) comparisons.
+ */
+static size_t gallop_array(sort_ctx_t *ctx,
+                           const element_t *key,
+                           element_t **a,
+                           size_t n,
+                           bool inclusive)
+{
+    size_t lo = 0, step = 1;
+
+    /* a[0..lo - 1] go before key */
+    while (lo + step <= n) {
+        int cmp = element_cmp(ctx, a[lo + step - 1], key);
+        if (inclusive ? cmp > 0 : cmp >= 0)
+            break;
+        lo += step;
+        step *= 2;
+    }
+
+    size_t hi = lo + step - 1 < n ? lo + step - 1 : n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = element_cmp(ctx, a[mid], key);
+        if (inclusive ? cmp <= 0 : cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Merge the sorted runs a[0..na - 1] and b[0..nb - 1] into dst. On ties the
+ * element from a goes first. Galloping follows the merges of queue.c: runs
+ * that do not overlap are copied after one comparison, and once one run wins
+ * min_gallop times in a row, blocks found by gallop_array() are copied whole.
+ */
+static void merge_arrays(sort_ctx_t *ctx,
+                         element_t **dst,
+                         element_t **a,
+                         size_t na,
+                         element_t **b,
+                         size_t nb)
+{
+    size_t i = 0, j = 0;
+    int min_gallop = q_gallop ? MIN_GALLOP + ctx->gallop_bias : INT_MAX;
+
+    bool disjoint =
+        q_gallop && na && nb && element_cmp(ctx, a[na - 1], b[0]) <= 0;
+
+    while (!disjoint && i < na && j < nb) {
+        int wins_a = 0, wins_b = 0;
+        do {
+            if (element_cmp(ctx, a[i], b[j]) <= 0) {
+                *dst++ = a[i++];
+                wins_a++;
+                wins_b = 0;
+            } else {
+                *dst++ = b[j++];
+                wins_b++;
+                wins_a = 0;
+            }
+        } while (i < na && j < nb && wins_a < min_gallop &&
+                 wins_b < min_gallop);
+
+        while (i < na && j < nb) {
+            size_t len_a = gallop_array(ctx, b[j], a + i, na - i, true);
+            memcpy(dst, a + i, len_a * sizeof(element_t *));
+            dst += len_a;
+            i += len_a;
+            if (i == na)
+                break;
+            size_t len_b = gallop_array(ctx, a[i], b + j, nb - j, false);
+            memcpy(dst, b + j, len_b * sizeof(element_t *));
+            dst += len_b;
+            j += len_b;
+
+            if (len_a < MIN_GALLOP && len_b < MIN_GALLOP) {
+                min_gallop += 2;
+                break;
+            }
+            if (min_gallop > 1)
+                min_gallop--;
+        }
+    }
+    memcpy(dst, a + i, (na - i) * sizeof(element_t *));
+    memcpy(dst + na - i, b + j, (nb - j) * sizeof(element_t *));
+    if (q_gallop)
+        ctx->gallop_bias = min_gallop - MIN_GALLOP;
+}
+
+element_t **element_merge_runs(sort_ctx_t *ctx,
+                               element_t **a,
+                               element_t **tmp,
+                               size_t *bounds,
+                               int k)
+{
+    unsigned long cmp_count = ctx->cmp_count;
+
+    while (k > 1) {
+        int i, runs = 0;
+        for (i = 0; i + 1 < k; i += 2) {
+            size_t lo = bounds[i], mid = bounds[i + 1], hi = bounds[i + 2];
+            merge_arrays(ctx, tmp + lo, a + lo, mid - lo, a + mid, hi - mid);
+            bounds[runs++] = lo;
+        }
+        /* An odd run out is carried over as is */
+        if (i < k) {
+            memcpy(tmp + bounds[i], a + bounds[i],
+                   (bounds[k] - bounds[i]) * sizeof(element_t *));
+            bounds[runs++] = bounds[i];
+        }
+        bounds[runs] = bounds[k];
+        k = runs;
+
+        element_t **swap = a;
+        a = tmp;
+        tmp = swap;
+    }
+    ctx->merge_cmp_count += ctx->cmp_count - cmp_count;
+    return a;
+}
+
+size_t element_dedup(element_t **a, size_t n)
+{
+    size_t w = 0;
+
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && !value_cmp(a[i], a[j]))
+            j++;
+        if (j - i == 1)
+            a[w++] = a[i];
+        else
+            while (i < j)
+                q_release_element(a[i++]);
+        i = j;
+    }
+    return w;
+}
+
+bool element_dedup_unsorted(element_t **a, size_t *n)
+{
+    size_t cap;
+    dedup_slot_t *table = dedup_table_new(*n, &cap);
+    if (!table)
+        return false;
+
+    /* Later occurrences go right away, first ones once all are known */
+    size_t w = 0;
+    for (size_t i = 0; i < *n; i++) {
+        dedup_slot_t *slot = dedup_lookup(table, cap, a[i]);
+        if (slot->e == a[i]) {
+            a[w++] = a[i];
+            continue;
+        }
+        slot->dup = 1;
+        q_release_element(a[i]);
+    }
+
+    size_t m = 0;
+    for (size_t i = 0; i < w; i++) {
+        if (dedup_lookup(table, cap, a[i])->dup)
+            q_release_element(a[i]);
+        else
+            a[m++] = a[i];
+    }
+    *n = m;
+
+    test_free_scratch(table);
+    return true;
+}
+
+size_t element_monotonic(element_t **a, size_t n, bool descend)
+{
+    if (!n)
+        return 0;
+
+    /* a[w..n - 1] holds the elements kept so far, scanning from the right */
+    size_t w = n - 1;
+    for (size_t i = n - 1; i-- > 0;) {
+        int cmp = value_cmp(a[i], a[w]);
+        if (descend ? cmp < 0 : cmp > 0)
+            q_release_element(a[i]);
+        else
+            a[--w] = a[i];
+    }
+    memmove(a, a + w, (n - w) * sizeof(element_t *));
+    return n - w;
+}
@@ -0,0 +1,141 @@
+#ifndef LAB0_ELEMENT_H
+#define LAB0_ELEMENT_H
+
+/* Element handling shared by the queue backends: allocation honoring the
+ * tunables of queue.h, string comparison, and operations on arrays of
+ * element pointers for backends that keep their elements in arrays.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "queue.h"
+
+/**
+ * sort_ctx_t - State shared by the comparisons of one sort or merge
+ * @descend: whether to order descending
+ * @cmp_count: number of key comparisons done, added to q_cmp_count when the
+ *             operation completes
+ * @merge_cmp_count: the part of @cmp_count spent merging sorted runs, added
+ *                   to q_merge_cmp_count
+ * @gallop_bias: adjustment of MIN_GALLOP learned by the merges so far
+ *
+ * Keeping the counter here instead of updating q_cmp_count directly lets
+ * concurrent sorts of separate sublists count without data races. A zeroed
+ * context with @descend set is ready for use.
+ */
+typedef struct {
+    bool descend;
+    unsigned long cmp_count;
+    unsigned long merge_cmp_count;
+    int gallop_bias;
+} sort_ctx_t;
+
+/* Number of consecutive wins of one run after which a merge starts to
+ * gallop, before adjustment by sort_ctx_t.gallop_bias
+ */
+#define MIN_GALLOP 7
+
+/* Add the counters of ctx to q_cmp_count and q_merge_cmp_count */
+static inline void sort_ctx_commit(const sort_ctx_t *ctx)
+{
+    q_cmp_count += ctx->cmp_count;
+    q_merge_cmp_count += ctx->merge_cmp_count;
+}
+
+/* Allocate an element holding a copy of s, honoring q_compact */
+element_t *element_new(const char *s);
+
+/* Copy the string of e to sp, truncated to at most bufsize - 1 characters */
+void element_copy_value(const element_t *e, char *sp, size_t bufsize);
+
+/* Compare the strings of two elements like strcmp() */
+static inline int value_cmp(const element_t *a, const element_t *b)
+{
+#ifdef QUEUE_KEY_PREFIX
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    /* The prefixes match. If they include the terminator (the last byte is
+     * zero), so do the strings; otherwise compare what follows.
+     */
+    if (!(a->key & 0xff))
+        return 0;
+    return strcmp(a->value + 8, b->value + 8);
+#else
+    return strcmp(a->value, b->value);
+#endif
+}
+
+/* Compare two elements for a sort, counting the call in ctx. The result is
+ * negated for descending order, so callers only deal with ascending order.
+ */
+static inline int element_cmp(sort_ctx_t *ctx,
+                              const element_t *a,
+                              const element_t *b)
+{
+    ctx->cmp_count++;
+    int cmp = value_cmp(a, b);
+    return ctx->descend ? -cmp : cmp;
+}
+
+/**
+ * dedup_slot_t - Slot of the open-addressing table used to find duplicates
+ * @e: first element seen with this string, NULL for an empty slot
+ * @hash: hash of the string
+ * @len: length of the string, truncated, to filter out mismatches cheaply
+ * @dup: whether the string was seen again after @e
+ */
+typedef struct {
+    element_t *e;
+    uint32_t hash;
+    uint32_t len : 31;
+    uint32_t dup : 1;
+} dedup_slot_t;
+
+/* Allocate an empty table for n strings as a scratch buffer, to be released
+ * with test_free_scratch(). Store the number of slots in cap. Return NULL if
+ * the allocation failed.
+ */
+dedup_slot_t *dedup_table_new(size_t n, size_t *cap);
+
+/* Return the slot holding the string of e. If there is none yet, e is put
+ * into the empty slot where its string belongs, and that slot is returned.
+ */
+dedup_slot_t *dedup_lookup(dedup_slot_t *table, size_t cap, element_t *e);
+
+/* Sort a[0..n - 1] in the order requested by ctx with multikey quicksort */
+void element_sort(sort_ctx_t *ctx, element_t **a, size_t n);
+
+/* Merge the k sorted runs a[bounds[i]..bounds[i + 1]) for 0 <= i < k, using
+ * tmp, which has room for as many pointers, as the other buffer. Runs are
+ * merged pairwise, so the merge is stable, galloping as allowed by q_gallop.
+ * Return whichever of a and tmp holds the result. bounds is clobbered.
+ */
+element_t **element_merge_runs(sort_ctx_t *ctx,
+                               element_t **a,
+                               element_t **tmp,
+                               size_t *bounds,
+                               int k);
+
+/* The following delete elements from a[0..n - 1], releasing them and
+ * packing the remaining ones at the front while keeping their order. They
+ * return the number of remaining elements.
+ */
+
+/* Delete all elements whose string also occurs in an adjacent element */
+size_t element_dedup(element_t **a, size_t n);
+
+/* Delete all elements whose string occurs more than once, in any order,
+ * updating *n. Return false, deleting nothing, if the hash table could not
+ * be allocated.
+ */
+bool element_dedup_unsorted(element_t **a, size_t *n);
+
+/* Delete every element that compares greater, or less if descend, than some
+ * element following it
+ */
+size_t element_monotonic(element_t **a, size_t n, bool descend);
+
+#endif /* LAB0_ELEMENT_H */
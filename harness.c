@@ -1,12 +1,15 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "list.h"
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -29,37 +32,65 @@
 
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
+/* Represent allocated blocks as entries of a hash table keyed by address,
+ * with the node of their bucket at beginning
  */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
+    struct hlist_node node;
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
+/* Initial number of buckets, as a power of two */
+#define BLOCK_TABLE_BITS 10
+
+/* Buckets of the allocated blocks. The table doubles whenever the blocks
+ * outnumber the buckets, so checking that a block is allocated inspects one
+ * block on average however many there are.
+ */
+static struct hlist_head block_table_init[1 << BLOCK_TABLE_BITS];
+static struct hlist_head *block_table = block_table_init;
+static int block_table_bits = BLOCK_TABLE_BITS;
 static size_t allocated_count = 0;
+static size_t allocated_bytes = 0;
+static size_t peak_bytes = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
+static bool threaded_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+/* Seconds a time-limited operation may run */
+int time_limit = 1;
 
 /* Data for managing exceptions */
 static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
 static bool time_limited = false;
 
+/* Serializes the bookkeeping of blocks in threaded mode */
+static pthread_mutex_t block_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Internal functions */
 
+static inline void block_lock_acquire()
+{
+    if (threaded_mode)
+        pthread_mutex_lock(&block_lock);
+}
+
+static inline void block_lock_release()
+{
+    if (threaded_mode)
+        pthread_mutex_unlock(&block_lock);
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
@@ -67,6 +98,51 @@ static bool fail_allocation()
     return (weight < 0.01 * fail_probability);
 }
 
+/* Bucket of a block address among 2^bits, by Fibonacci hashing, which lets
+ * the high bits of the product mix in every bit of the address
+ */
+static inline size_t block_hash(const void *b, int bits)
+{
+    return (uint64_t) (uintptr_t) b * 0x9e3779b97f4a7c15ULL >> (64 - bits);
+}
+
+static inline struct hlist_head *block_bucket(const void *b)
+{
+    return &block_table[block_hash(b, block_table_bits)];
+}
+
+/* Double the number of buckets. The table is left as is if no memory is
+ * available for a new one, which only makes its chains longer.
+ *
+ * The rehash relinks blocks into a table installed only at the end, so
+ * SIGALRM is blocked meanwhile: a time limit unwinding from the middle
+ * would strand blocks where find_header() can no longer see them.
+ */
+static void block_table_grow()
+{
+    int bits = block_table_bits + 1;
+    struct hlist_head *table = calloc((size_t) 1 << bits, sizeof(*table));
+    if (!table)
+        return;
+
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    for (size_t i = 0; i < (size_t) 1 << block_table_bits; i++) {
+        struct hlist_node *node, *safe;
+        hlist_for_each_safe (node, safe, &block_table[i]) {
+            block_element_t *b = hlist_entry(node, block_element_t, node);
+            hlist_add_head(node, &table[block_hash(b, bits)]);
+        }
+    }
+    if (block_table != block_table_init)
+        free(block_table);
+    block_table = table;
+    block_table_bits = bits;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
 /* Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
  */
@@ -81,13 +157,12 @@ static block_element_t *find_header(void *p)
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
+        struct hlist_node *node;
+        hlist_for_each (node, block_bucket(b)) {
+            if (node == &b->node)
+                break;
         }
-        if (!found) {
+        if (!node) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -143,15 +218,16 @@ void *test_malloc(size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
+    block_lock_acquire();
+    if (allocated_count >= (size_t) 1 << block_table_bits)
+        block_table_grow();
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
+    hlist_add_head(&new_block->node, block_bucket(new_block));
     allocated_count++;
+    allocated_bytes += size;
+    if (allocated_bytes > peak_bytes)
+        peak_bytes = allocated_bytes;
+    block_lock_release();
 
     return p;
 }
@@ -178,6 +254,7 @@ void test_free(void *p)
     if (!p)
         return;
 
+    block_lock_acquire();
     block_element_t *b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
@@ -187,22 +264,17 @@ void test_free(void *p)
                      p);
         error_occurred = true;
     }
+    allocated_bytes -= b->payload_size;
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
 
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
+    /* Unlink from its bucket */
+    hlist_del(&b->node);
+    allocated_count--;
+    block_lock_release();
 
     free(b);
-    allocated_count--;
 }
 
 // cppcheck-suppress unusedFunction
@@ -216,11 +288,35 @@ char *test_strdup(const char *s)
     return memcpy(new, s, len);
 }
 
+void *test_malloc_scratch(size_t size)
+{
+    bool noallocate = noallocate_mode;
+    noallocate_mode = false;
+    void *p = test_malloc(size);
+    noallocate_mode = noallocate;
+    return p;
+}
+
+void test_free_scratch(void *p)
+{
+    bool noallocate = noallocate_mode;
+    noallocate_mode = false;
+    test_free(p);
+    noallocate_mode = noallocate;
+}
+
 size_t allocation_check()
 {
     return allocated_count;
 }
 
+size_t allocation_bytes(size_t *peak)
+{
+    *peak = peak_bytes;
+    peak_bytes = allocated_bytes;
+    return allocated_bytes;
+}
+
 /* Implementation of functions for testing */
 
 /* Set/unset cautious mode.
@@ -231,6 +327,15 @@ void set_cautious_mode(bool cautious)
     cautious_mode = cautious;
 }
 
+/* Set/unset threaded mode.
+ * In this mode, several threads may allocate and free blocks concurrently.
+ * Signals unwinding through the harness must be blocked meanwhile.
+ */
+void set_threaded_mode(bool threaded)
+{
+    threaded_mode = threaded;
+}
+
 /* Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
@@ -16,20 +16,43 @@ void test_free(void *p);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
+/* Scratch buffers are temporary space an operation releases before it
+ * returns. Unlike test_malloc() and test_free(), they are permitted in
+ * noallocate mode, which only forbids allocating or freeing queue storage.
+ * Allocation may still fail, so callers need a fallback.
+ */
+void *test_malloc_scratch(size_t size);
+void test_free_scratch(void *p);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Report number of bytes in allocated blocks, not counting the overhead of
+ * the harness. Store in *peak the largest number reached since the last
+ * call.
+ */
+size_t allocation_bytes(size_t *peak);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Number of seconds a time-limited operation may run before it is aborted */
+extern int time_limit;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Set/unset threaded mode.
+ * In this mode, several threads may allocate and free blocks concurrently.
+ */
+void set_threaded_mode(bool threaded);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
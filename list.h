@@ -428,6 +428,534 @@ static inline void list_move_tail(struct list_head *node,
          &entry->member != (head); entry = safe,                           \
         safe = list_entry(safe->member.next, __typeof__(*entry), member))
 
+/* A walk whose loop body does real work on each node spends much of its time
+ * waiting for the next node to arrive from memory, once the nodes no longer
+ * sit in allocation order. The prefetching variants below request a node a
+ * fixed distance ahead at every step, so that its load overlaps with the work
+ * on the current one. The nodes in between were requested by the previous
+ * steps, so looking ahead needs no extra state. A walk with a trivial body is
+ * bound by the chain of loads itself and gains nothing.
+ */
+
+/**
+ * LIST_PREFETCH_DISTANCE - Number of nodes the prefetching walks look ahead
+ *
+ * Can be overridden before including this header. Looking further than the
+ * next node only pays when the work on a node takes longer than a load from
+ * memory; otherwise following the links ahead stalls on nodes still in
+ * flight.
+ */
+#ifndef LIST_PREFETCH_DISTANCE
+#define LIST_PREFETCH_DISTANCE 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __list_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define __list_prefetch(addr) ((void) (addr))
+#endif
+
+/**
+ * list_prefetch_next() - Prefetch the node a fixed distance after a node
+ * @node: pointer to the current node
+ * @head: pointer to the head of the list
+ *
+ * Requests the node LIST_PREFETCH_DISTANCE links after @node, or the last one
+ * before @head or a NULL link when the list ends sooner.
+ */
+static inline void list_prefetch_next(const struct list_head *node,
+                                      const struct list_head *head)
+{
+    for (int i = 1;
+         i < LIST_PREFETCH_DISTANCE && node->next && node->next != head; i++)
+        node = node->next;
+    __list_prefetch(node->next);
+}
+
+/**
+ * list_prefetch_prev() - Prefetch the node a fixed distance before a node
+ * @node: pointer to the current node
+ * @head: pointer to the head of the list
+ *
+ * The backward counterpart of list_prefetch_next().
+ */
+static inline void list_prefetch_prev(const struct list_head *node,
+                                      const struct list_head *head)
+{
+    for (int i = 1;
+         i < LIST_PREFETCH_DISTANCE && node->prev && node->prev != head; i++)
+        node = node->prev;
+    __list_prefetch(node->prev);
+}
+
+/**
+ * list_for_each_prefetch - Iterate over list nodes, prefetching ahead
+ * @node: list_head pointer used as iterator
+ * @head: pointer to the head of the list
+ *
+ * Same as list_for_each(), with list_prefetch_next() at every step.
+ */
+#define list_for_each_prefetch(node, head)                     \
+    for (node = (head)->next;                                  \
+         node != (head) && (list_prefetch_next(node, head), 1); \
+         node = node->next)
+
+/**
+ * list_for_each_entry_prefetch - Iterate over list entries, prefetching ahead
+ * @entry: pointer used as iterator
+ * @head: pointer to the head of the list
+ * @member: name of the list_head member variable in struct type of @entry
+ *
+ * Same as list_for_each_entry(), with list_prefetch_next() at every step.
+ */
+#ifdef __LIST_HAVE_TYPEOF
+#define list_for_each_entry_prefetch(entry, head, member)              \
+    for (entry = list_entry((head)->next, __typeof__(*entry), member); \
+         &entry->member != (head) &&                                   \
+         (list_prefetch_next(&entry->member, head), 1);                \
+         entry = list_entry(entry->member.next, __typeof__(*entry), member))
+#endif
+
+/**
+ * list_for_each_entry_safe_prefetch - Iterate over list entries, prefetching
+ * ahead and allowing deletes
+ * @entry: pointer used as iterator
+ * @safe: @type pointer used to store info for next entry in list
+ * @head: pointer to the head of the list
+ * @member: name of the list_head member variable in struct type of @entry
+ *
+ * Same as list_for_each_entry_safe(), with list_prefetch_next() at every
+ * step.
+ */
+#ifdef __LIST_HAVE_TYPEOF
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member)       \
+    for (entry = list_entry((head)->next, __typeof__(*entry), member),     \
+        safe = list_entry(entry->member.next, __typeof__(*entry), member); \
+         &entry->member != (head) &&                                       \
+         (list_prefetch_next(&entry->member, head), 1);                    \
+         entry = safe,                                                     \
+        safe = list_entry(safe->member.next, __typeof__(*entry), member))
+#endif
+
+/**
+ * list_cmp_func_t - Comparison function of list_sort()
+ * @priv: private data passed to list_sort()
+ * @a: first node
+ * @b: second node
+ *
+ * Return: > 0 to sort @a after @b, <= 0 to keep @a before @b. As in the
+ * Linux kernel, a plain "a > b" boolean is enough.
+ */
+typedef int (*list_cmp_func_t)(void *priv,
+                               const struct list_head *a,
+                               const struct list_head *b);
+
+/* Merge the NULL-terminated lists a and b into one, taking nodes from a on
+ * ties, and count the comparisons in *count. The prev pointers are left
+ * unchanged.
+ */
+static inline struct list_head *__list_sort_merge(void *priv,
+                                                  list_cmp_func_t cmp,
+                                                  struct list_head *a,
+                                                  struct list_head *b,
+                                                  size_t *count)
+{
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        (*count)++;
+        if (cmp(priv, a, b) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/* Like __list_sort_merge(), but append the result to the empty list head,
+ * restoring the prev pointers and the circular links
+ */
+static inline void __list_sort_merge_final(void *priv,
+                                           list_cmp_func_t cmp,
+                                           struct list_head *head,
+                                           struct list_head *a,
+                                           struct list_head *b,
+                                           size_t *count)
+{
+    struct list_head *tail = head;
+
+    for (;;) {
+        (*count)++;
+        if (cmp(priv, a, b) <= 0) {
+            tail->next = a;
+            a->prev = tail;
+            tail = a;
+            a = a->next;
+            if (!a)
+                break;
+        } else {
+            tail->next = b;
+            b->prev = tail;
+            tail = b;
+            b = b->next;
+            if (!b) {
+                b = a;
+                break;
+            }
+        }
+    }
+
+    /* Link the rest of the remaining list */
+    tail->next = b;
+    do {
+        b->prev = tail;
+        tail = b;
+        b = b->next;
+    } while (b);
+    tail->next = head;
+    head->prev = tail;
+}
+
+/**
+ * list_sort() - Sort a list in a stable way
+ * @priv: private data passed to @cmp
+ * @head: pointer to the head of the list
+ * @cmp: comparison function, see list_cmp_func_t
+ *
+ * This is the bottom-up merge sort of lib/list_sort.c in the Linux kernel,
+ * with the same signature. Nodes equal according to @cmp keep their order.
+ * No memory is allocated.
+ *
+ * The list is consumed one node at a time and kept as a stack of sorted
+ * sublists ("pending"), whose sizes are powers of two. The sublists are
+ * NULL-terminated through their next pointers and chained to each other
+ * through the prev pointer of their first node. Whenever the count of
+ * nodes consumed so far reaches a value whose lowest set bit is k, two
+ * pending sublists of size 2^k are merged. This keeps the merges balanced,
+ * never worse than 2:1, and lets them work on sublists that were visited
+ * recently and are likely still in cache.
+ *
+ * Return: the number of calls to @cmp, for instrumentation. Callers written
+ * for the kernel, which returns nothing, may ignore it.
+ */
+static inline size_t list_sort(void *priv,
+                               struct list_head *head,
+                               list_cmp_func_t cmp)
+{
+    struct list_head *list = head->next, *pending = NULL;
+    size_t count = 0; /* Count of pending sublists */
+    size_t calls = 0;
+
+    if (list == head->prev) /* Zero or one elements */
+        return 0;
+
+    /* Convert to a NULL-terminated singly-linked list */
+    head->prev->next = NULL;
+
+    do {
+        size_t bits;
+        struct list_head **tail = &pending;
+
+        /* Find the least-significant clear bit in count */
+        for (bits = count; bits & 1; bits >>= 1)
+            tail = &(*tail)->prev;
+        /* Do the indicated merge, unless count is a power of two minus one */
+        if (bits) {
+            struct list_head *a = *tail, *b = a->prev;
+
+            a = __list_sort_merge(priv, cmp, b, a, &calls);
+            /* Install the merged result in place of the inputs */
+            a->prev = b->prev;
+            *tail = a;
+        }
+
+        /* Move one element from input list to pending */
+        list->prev = pending;
+        pending = list;
+        list = list->next;
+        pending->next = NULL;
+        count++;
+    } while (list);
+
+    /* End of input; merge together all the pending lists */
+    list = pending;
+    pending = pending->prev;
+    for (;;) {
+        struct list_head *next = pending->prev;
+
+        if (!next)
+            break;
+        list = __list_sort_merge(priv, cmp, pending, list, &calls);
+        pending = next;
+    }
+    /* The final merge, rebuilding prev links */
+    __list_sort_merge_final(priv, cmp, head, pending, list, &calls);
+    return calls;
+}
+
+/**
+ * struct hlist_head - Head of a doubly-linked list with a single pointer
+ * @first: pointer to the first node of the list, or NULL if it is empty
+ *
+ * Lists of this kind are meant for the buckets of hash tables, where a head
+ * half the size of struct list_head halves the bucket array. The price is
+ * that the tail of the list cannot be reached in constant time. The list is
+ * NULL-terminated rather than circular.
+ */
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+/**
+ * struct hlist_node - Node of a doubly-linked list with a single pointer head
+ * @next: pointer to the next node in the list, or NULL for the last one
+ * @pprev: pointer to the pointer to this node, either @next of the previous
+ *         node or @first of the head
+ *
+ * Through @pprev a node can be removed without knowing whether it is the
+ * first one, and so without access to the head.
+ */
+struct hlist_node {
+    struct hlist_node *next, **pprev;
+};
+
+/**
+ * HLIST_HEAD_INIT - Initializer of an empty hlist head
+ */
+#define HLIST_HEAD_INIT {.first = NULL}
+
+/**
+ * HLIST_HEAD - Declare hlist head and initialize it
+ * @head: name of the new list
+ */
+#define HLIST_HEAD(head) struct hlist_head head = HLIST_HEAD_INIT
+
+/**
+ * INIT_HLIST_HEAD() - Initialize empty hlist head
+ * @head: pointer to hlist head
+ */
+static inline void INIT_HLIST_HEAD(struct hlist_head *head)
+{
+    head->first = NULL;
+}
+
+/**
+ * INIT_HLIST_NODE() - Initialize unlinked hlist node
+ * @node: pointer to the node
+ *
+ * hlist_unhashed() is true for an initialized, unlinked node, and
+ * hlist_del_init() leaves it unchanged.
+ */
+static inline void INIT_HLIST_NODE(struct hlist_node *node)
+{
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/**
+ * hlist_unhashed() - Check if hlist node is not linked into a list
+ * @node: pointer to the node
+ *
+ * Only meaningful for nodes initialized with INIT_HLIST_NODE() or removed
+ * with hlist_del_init().
+ *
+ * Return: 0 - node is linked !0 - node is unlinked
+ */
+static inline int hlist_unhashed(const struct hlist_node *node)
+{
+    return !node->pprev;
+}
+
+/**
+ * hlist_empty() - Check if hlist head has no nodes attached
+ * @head: pointer to the head of the list
+ *
+ * Return: 0 - list is not empty !0 - list is empty
+ */
+static inline int hlist_empty(const struct hlist_head *head)
+{
+    return !head->first;
+}
+
+/**
+ * hlist_del() - Remove a node from its hlist
+ * @node: pointer to the node
+ *
+ * As with list_del(), the node is left uninitialized, and LIST_POISONING
+ * makes later accesses through its pointers fault.
+ */
+static inline void hlist_del(struct hlist_node *node)
+{
+    struct hlist_node *next = node->next;
+    struct hlist_node **pprev = node->pprev;
+
+    *pprev = next;
+    if (next)
+        next->pprev = pprev;
+
+#ifdef LIST_POISONING
+    node->next = (struct hlist_node *) (0x00100100);
+    node->pprev = (struct hlist_node **) (0x00200200);
+#endif
+}
+
+/**
+ * hlist_del_init() - Remove a node from its hlist and reinitialize it
+ * @node: pointer to the node
+ *
+ * Unlike hlist_del(), this is also safe on an unlinked node.
+ */
+static inline void hlist_del_init(struct hlist_node *node)
+{
+    if (hlist_unhashed(node))
+        return;
+    hlist_del(node);
+    INIT_HLIST_NODE(node);
+}
+
+/**
+ * hlist_add_head() - Add a node to the beginning of the hlist
+ * @node: pointer to the new node
+ * @head: pointer to the head of the list
+ */
+static inline void hlist_add_head(struct hlist_node *node,
+                                  struct hlist_head *head)
+{
+    struct hlist_node *first = head->first;
+
+    node->next = first;
+    if (first)
+        first->pprev = &node->next;
+    head->first = node;
+    node->pprev = &head->first;
+}
+
+/**
+ * hlist_add_before() - Add a node before another in its hlist
+ * @node: pointer to the new node
+ * @next: pointer to a node linked into the list
+ */
+static inline void hlist_add_before(struct hlist_node *node,
+                                    struct hlist_node *next)
+{
+    node->pprev = next->pprev;
+    node->next = next;
+    next->pprev = &node->next;
+    *node->pprev = node;
+}
+
+/**
+ * hlist_add_behind() - Add a node after another in its hlist
+ * @node: pointer to the new node
+ * @prev: pointer to a node linked into the list
+ */
+static inline void hlist_add_behind(struct hlist_node *node,
+                                    struct hlist_node *prev)
+{
+    node->next = prev->next;
+    prev->next = node;
+    node->pprev = &prev->next;
+
+    if (node->next)
+        node->next->pprev = &node->next;
+}
+
+/**
+ * hlist_entry() - Get the entry for this hlist node
+ * @node: pointer to hlist node
+ * @type: type of the entry containing the hlist node
+ * @member: name of the hlist_node member variable in struct @type
+ *
+ * Return: @type pointer of entry containing node
+ */
+#define hlist_entry(node, type, member) container_of(node, type, member)
+
+/**
+ * hlist_entry_safe() - Get the entry for this hlist node, or NULL
+ * @node: pointer to hlist node, or NULL
+ * @type: type of the entry containing the hlist node
+ * @member: name of the hlist_node member variable in struct @type
+ *
+ * Return: @type pointer of entry containing node, or NULL if @node is NULL
+ */
+#ifdef __LIST_HAVE_TYPEOF
+#define hlist_entry_safe(node, type, member)                 \
+    __extension__({                                          \
+        __typeof__(node) __pnode = (node);                   \
+        __pnode ? hlist_entry(__pnode, type, member) : NULL; \
+    })
+#endif
+
+/**
+ * hlist_for_each - Iterate over hlist nodes
+ * @node: hlist_node pointer used as iterator
+ * @head: pointer to the head of the list
+ *
+ * The nodes of the list must be kept unmodified while iterating through it.
+ */
+#define hlist_for_each(node, head) \
+    for (node = (head)->first; node; node = node->next)
+
+/**
+ * hlist_for_each_safe - Iterate over hlist nodes and allow deletions
+ * @node: hlist_node pointer used as iterator
+ * @safe: hlist_node pointer used to store info for next node in list
+ * @head: pointer to the head of the list
+ *
+ * The current node (iterator) is allowed to be removed from the list. Any
+ * other modifications to the the list will cause undefined behavior.
+ */
+#define hlist_for_each_safe(node, safe, head)                  \
+    for (node = (head)->first; node && (safe = node->next, 1); \
+         node = safe)
+
+/**
+ * hlist_for_each_entry - Iterate over hlist entries
+ * @entry: pointer used as iterator
+ * @head: pointer to the head of the list
+ * @member: name of the hlist_node member variable in struct type of @entry
+ *
+ * The nodes of the list must be kept unmodified while iterating through it.
+ */
+#ifdef __LIST_HAVE_TYPEOF
+#define hlist_for_each_entry(entry, head, member)                             \
+    for (entry = hlist_entry_safe((head)->first, __typeof__(*entry), member); \
+         entry;                                                               \
+         entry = hlist_entry_safe(entry->member.next, __typeof__(*entry),     \
+                                  member))
+#endif
+
+/**
+ * hlist_for_each_entry_safe - Iterate over hlist entries and allow deletes
+ * @entry: pointer used as iterator
+ * @safe: hlist_node pointer used to store info for next node in list
+ * @head: pointer to the head of the list
+ * @member: name of the hlist_node member variable in struct type of @entry
+ *
+ * The current node (iterator) is allowed to be removed from the list. Any
+ * other modifications to the the list will cause undefined behavior. As in
+ * the Linux kernel, @safe is a node rather than an entry.
+ */
+#ifdef __LIST_HAVE_TYPEOF
+#define hlist_for_each_entry_safe(entry, safe, head, member)                  \
+    for (entry = hlist_entry_safe((head)->first, __typeof__(*entry), member); \
+         entry && (safe = entry->member.next, 1);                             \
+         entry = hlist_entry_safe(safe, __typeof__(*entry), member))
+#endif
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
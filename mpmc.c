@@ -0,0 +1,292 @@
+/* Lock-free multi-producer multi-consumer queue
+ *
+ * The algorithm is the one of M. M. Michael and M. L. Scott, "Simple, Fast,
+ * and Practical Non-Blocking and Blocking Concurrent Queue Algorithms"
+ * (PODC 1996). The queue is a singly-linked list of nodes starting with a
+ * dummy node. Insertion links a node after the last one with a CAS and then
+ * swings the tail to it; removal swings the head to the node following the
+ * dummy, which becomes the new dummy, and retires the old one.
+ *
+ * Retired nodes are reclaimed with hazard pointers (M. M. Michael, "Hazard
+ * Pointers: Safe Memory Reclamation for Lock-Free Objects", IEEE TPDS 2004).
+ * Before dereferencing a node, a thread publishes its address in one of the
+ * hazard pointers of its handle and checks that the node is still reachable.
+ * A retired node is only freed by a scan that finds it in no hazard pointer.
+ *
+ * Every atomic operation uses the default sequentially consistent ordering:
+ * publishing a hazard pointer must be ordered before the load validating it,
+ * which weaker orderings do not guarantee.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "element.h"
+#include "mpmc.h"
+
+/* Hazard pointers per handle: removal protects the dummy and its successor */
+#define HP_PER_HANDLE 2
+
+/* Number of retired nodes a handle accumulates before scanning. Twice the
+ * number of hazard pointers guarantees a scan frees at least half of them.
+ */
+#define RETIRE_MAX (2 * HP_PER_HANDLE * MPMC_MAX_THREADS)
+
+typedef struct mpmc_node {
+    _Atomic(struct mpmc_node *) next;
+    element_t *e;
+} mpmc_node_t;
+
+/**
+ * struct mpmc_handle - Hazard pointer record of a thread
+ * @q: queue this record belongs to
+ * @hp: nodes the owning thread may be reading
+ * @used: whether a thread owns this record
+ * @nr_retired: number of entries in @retired
+ * @retired: removed nodes waiting to be freed
+ *
+ * Records are never freed before the queue, so scans may read the hazard
+ * pointers of any of them without synchronizing with their owners.
+ */
+struct mpmc_handle {
+    mpmc_t *q;
+    _Atomic(mpmc_node_t *) hp[HP_PER_HANDLE];
+    atomic_bool used;
+    int nr_retired;
+    mpmc_node_t *retired[RETIRE_MAX];
+};
+
+/* Bytes between head and tail, so that producers and consumers do not
+ * invalidate each other's cache line. The harness aligns blocks to less than
+ * a line, hence padding rather than alignment.
+ */
+#define CACHE_LINE 64
+
+struct mpmc {
+    _Atomic(mpmc_node_t *) head;
+    char pad_head[CACHE_LINE];
+    _Atomic(mpmc_node_t *) tail;
+    char pad_tail[CACHE_LINE];
+    _Atomic(mpmc_handle_t *) handles[MPMC_MAX_THREADS];
+};
+
+mpmc_t *mpmc_new(void)
+{
+    mpmc_t *q = malloc(sizeof(mpmc_t));
+    mpmc_node_t *dummy = malloc(sizeof(mpmc_node_t));
+    if (!q || !dummy) {
+        free(q);
+        free(dummy);
+        return NULL;
+    }
+
+    atomic_init(&dummy->next, NULL);
+    dummy->e = NULL;
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    for (int i = 0; i < MPMC_MAX_THREADS; i++)
+        atomic_init(&q->handles[i], NULL);
+    return q;
+}
+
+void mpmc_free(mpmc_t *q)
+{
+    if (!q)
+        return;
+
+    /* The first node is the dummy, whose element was already removed */
+    mpmc_node_t *node = atomic_load(&q->head);
+    for (bool dummy = true; node; dummy = false) {
+        mpmc_node_t *next = atomic_load(&node->next);
+        if (!dummy)
+            q_release_element(node->e);
+        free(node);
+        node = next;
+    }
+
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        mpmc_handle_t *h = atomic_load(&q->handles[i]);
+        if (!h)
+            continue;
+        for (int j = 0; j < h->nr_retired; j++)
+            free(h->retired[j]);
+        free(h);
+    }
+    free(q);
+}
+
+mpmc_handle_t *mpmc_attach(mpmc_t *q)
+{
+    /* Reuse a record given back by another thread, if any */
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        mpmc_handle_t *h = atomic_load(&q->handles[i]);
+        bool unused = false;
+        if (h && atomic_compare_exchange_strong(&h->used, &unused, true))
+            return h;
+    }
+
+    mpmc_handle_t *h = malloc(sizeof(mpmc_handle_t));
+    if (!h)
+        return NULL;
+    h->q = q;
+    for (int j = 0; j < HP_PER_HANDLE; j++)
+        atomic_init(&h->hp[j], NULL);
+    atomic_init(&h->used, true);
+    h->nr_retired = 0;
+
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        mpmc_handle_t *empty = NULL;
+        if (atomic_compare_exchange_strong(&q->handles[i], &empty, h))
+            return h;
+    }
+    free(h);
+    return NULL;
+}
+
+void mpmc_detach(mpmc_handle_t *h)
+{
+    /* Retired nodes stay with the record for its next owner to scan */
+    atomic_store(&h->used, false);
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(void *const *) a;
+    uintptr_t y = (uintptr_t) *(void *const *) b;
+    return (x > y) - (x < y);
+}
+
+/* Free the retired nodes of h that no hazard pointer protects */
+static void scan(mpmc_handle_t *h)
+{
+    mpmc_node_t *hazards[HP_PER_HANDLE * MPMC_MAX_THREADS];
+    size_t nr_hazards = 0;
+
+    for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+        mpmc_handle_t *other = atomic_load(&h->q->handles[i]);
+        if (!other)
+            continue;
+        for (int j = 0; j < HP_PER_HANDLE; j++) {
+            mpmc_node_t *p = atomic_load(&other->hp[j]);
+            if (p)
+                hazards[nr_hazards++] = p;
+        }
+    }
+    qsort(hazards, nr_hazards, sizeof(mpmc_node_t *), ptr_cmp);
+
+    int kept = 0;
+    for (int i = 0; i < h->nr_retired; i++) {
+        mpmc_node_t *node = h->retired[i];
+        if (bsearch(&node, hazards, nr_hazards, sizeof(mpmc_node_t *),
+                    ptr_cmp))
+            h->retired[kept++] = node;
+        else
+            free(node);
+    }
+    h->nr_retired = kept;
+}
+
+static void retire(mpmc_handle_t *h, mpmc_node_t *node)
+{
+    h->retired[h->nr_retired++] = node;
+    if (h->nr_retired == RETIRE_MAX)
+        scan(h);
+}
+
+/* Publish *src in hazard pointer i of h. Return the protected node, which
+ * *src still pointed to after publication.
+ */
+static mpmc_node_t *protect(mpmc_handle_t *h,
+                            int i,
+                            _Atomic(mpmc_node_t *) *src)
+{
+    mpmc_node_t *p = atomic_load(src);
+    for (;;) {
+        atomic_store(&h->hp[i], p);
+        mpmc_node_t *again = atomic_load(src);
+        if (again == p)
+            return p;
+        p = again;
+    }
+}
+
+bool mpmc_insert_tail(mpmc_handle_t *h, char *s)
+{
+    if (!h || !s)
+        return false;
+
+    element_t *e = element_new(s);
+    if (!e)
+        return false;
+    mpmc_node_t *node = malloc(sizeof(mpmc_node_t));
+    if (!node) {
+        q_release_element(e);
+        return false;
+    }
+    node->e = e;
+    atomic_init(&node->next, NULL);
+
+    mpmc_t *q = h->q;
+    for (;;) {
+        mpmc_node_t *tail = protect(h, 0, &q->tail);
+        mpmc_node_t *next = atomic_load(&tail->next);
+        if (tail != atomic_load(&q->tail))
+            continue;
+
+        /* Help an insertion that linked its node but has not swung the
+         * tail yet
+         */
+        if (next) {
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+
+        mpmc_node_t *expected = NULL;
+        if (atomic_compare_exchange_weak(&tail->next, &expected, node)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, node);
+            break;
+        }
+    }
+    atomic_store(&h->hp[0], NULL);
+    return true;
+}
+
+element_t *mpmc_remove_head(mpmc_handle_t *h, char *sp, size_t bufsize)
+{
+    if (!h)
+        return NULL;
+
+    mpmc_t *q = h->q;
+    mpmc_node_t *head;
+    element_t *e;
+    for (;;) {
+        head = protect(h, 0, &q->head);
+        mpmc_node_t *tail = atomic_load(&q->tail);
+        mpmc_node_t *next = protect(h, 1, &head->next);
+        if (head != atomic_load(&q->head))
+            continue;
+
+        if (!next) {
+            e = NULL;
+            break;
+        }
+        /* The tail lags behind a linked node, so move it first */
+        if (head == tail) {
+            atomic_compare_exchange_weak(&q->tail, &tail, next);
+            continue;
+        }
+
+        e = next->e;
+        if (atomic_compare_exchange_weak(&q->head, &head, next))
+            break;
+    }
+    atomic_store(&h->hp[0], NULL);
+    atomic_store(&h->hp[1], NULL);
+
+    if (!e)
+        return NULL;
+    retire(h, head);
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
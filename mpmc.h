@@ -0,0 +1,77 @@
+#ifndef LAB0_MPMC_H
+#define LAB0_MPMC_H
+
+/* Lock-free multi-producer multi-consumer queue
+ *
+ * A Michael-Scott queue of element_t built on C11 atomics. Any number of
+ * threads may insert at its tail and remove from its head concurrently.
+ * Unlike the queues of queue.h, each thread works through a handle of its
+ * own, which holds the hazard pointers protecting the nodes the thread is
+ * reading, so that removed nodes are only freed once no thread can still
+ * read them.
+ *
+ * Allocation goes through the harness, which must be in threaded mode
+ * while several threads use a queue. Interning (q_intern) is not supported.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Maximum number of handles a queue may have at any time */
+#define MPMC_MAX_THREADS 64
+
+typedef struct mpmc mpmc_t;
+typedef struct mpmc_handle mpmc_handle_t;
+
+/**
+ * mpmc_new() - Create an empty queue
+ *
+ * Return: the new queue, or NULL if allocation failed
+ */
+mpmc_t *mpmc_new(void);
+
+/**
+ * mpmc_free() - Free a queue along with the elements it still holds
+ * @q: queue no thread uses any more, or NULL
+ */
+void mpmc_free(mpmc_t *q);
+
+/**
+ * mpmc_attach() - Get a handle on a queue for the calling thread
+ * @q: the queue
+ *
+ * Return: the handle, or NULL if all MPMC_MAX_THREADS handles are in use
+ */
+mpmc_handle_t *mpmc_attach(mpmc_t *q);
+
+/**
+ * mpmc_detach() - Give back a handle once the thread is done with the queue
+ * @h: handle returned by mpmc_attach()
+ */
+void mpmc_detach(mpmc_handle_t *h);
+
+/**
+ * mpmc_insert_tail() - Insert an element at tail of queue, like
+ * q_insert_tail()
+ * @h: handle of the calling thread
+ * @s: string to be copied into the new element
+ *
+ * Return: true for success, false for allocation failure or NULL @s
+ */
+bool mpmc_insert_tail(mpmc_handle_t *h, char *s);
+
+/**
+ * mpmc_remove_head() - Remove the element from head of queue, like
+ * q_remove_head()
+ * @h: handle of the calling thread
+ * @sp: buffer receiving a copy of the removed string, or NULL
+ * @bufsize: size of @sp
+ *
+ * Return: the removed element, to be released with q_release_element(),
+ * or NULL if the queue was empty
+ */
+element_t *mpmc_remove_head(mpmc_handle_t *h, char *sp, size_t bufsize);
+
+#endif /* LAB0_MPMC_H */
@@ -3,8 +3,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +48,8 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "mpmc.h"
+#include "twolock.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -53,7 +58,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -75,8 +79,14 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Queue of the stress command, indexing stress_queues */
+static int stress_queue = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
+
+/* How many strings are handed to the bulk insertion interface per call */
+#define BULK_SIZE 1024
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 /* For queue_insert and queue_remove */
 typedef enum {
@@ -101,9 +111,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -116,7 +123,6 @@ static bool do_free(int argc, char *argv[])
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -178,6 +184,118 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Validate the string of a freshly inserted element. inserts is the string
+ * passed to the insertion and lasts is the string of the previously inserted
+ * element, if any.
+ */
+static bool check_inserted(const element_t *entry,
+                           const char *inserts,
+                           const char *lasts)
+{
+    const char *cur_inserts = entry->value;
+    if (!cur_inserts) {
+        report(1, "ERROR: Failed to save copy of string in queue");
+        return false;
+    }
+    bool shared = q_is_interned(cur_inserts);
+    if (q_intern && !shared) {
+        report(1, "ERROR: String is not interned in interning mode");
+        return false;
+    }
+    bool inline_expected =
+        q_compact || (q_sso_max > 0 && strlen(inserts) <= (size_t) q_sso_max);
+    if (!q_intern && inline_expected && !q_element_is_compact(entry)) {
+        report(1,
+               "ERROR: String is not stored inline with its element in "
+               "compact layout");
+        return false;
+    }
+    if (inserts == cur_inserts) {
+        report(1,
+               "ERROR: Need to allocate and copy string for new queue "
+               "element");
+        return false;
+    }
+    if (lasts == cur_inserts && !shared) {
+        report(1,
+               "ERROR: Need to allocate separate string for each queue "
+               "element");
+        return false;
+    }
+    return true;
+}
+
+/* Account for a failed insertion of inserts */
+static bool insert_failed(const char *inserts)
+{
+    fail_count++;
+    if (fail_count < fail_limit) {
+        report(2, "Insertion of %s failed", inserts);
+        return true;
+    }
+    report(1, "ERROR: Insertion of %s failed (%d failures total)", inserts,
+           fail_count);
+    return false;
+}
+
+/* Insert reps strings through q_insert_head_bulk() or q_insert_tail_bulk(),
+ * BULK_SIZE at a time, then report the throughput.
+ */
+static bool queue_insert_bulk(position_t pos,
+                              char *inserts,
+                              bool need_rand,
+                              int reps)
+{
+    static char randstr_bulk[BULK_SIZE][MAX_RANDSTR_LEN];
+    char *strs[BULK_SIZE];
+    const char *lasts = NULL;
+    bool ok = true;
+    int total = 0;
+    double start;
+
+    init_time(&start);
+    for (int r = 0; ok && r < reps;) {
+        int n = reps - r < BULK_SIZE ? reps - r : BULK_SIZE;
+        for (int i = 0; i < n; i++) {
+            if (need_rand)
+                fill_rand_string(randstr_bulk[i], MAX_RANDSTR_LEN);
+            strs[i] = need_rand ? randstr_bulk[i] : inserts;
+        }
+
+        int cnt = pos == POS_TAIL ? q_insert_tail_bulk(current->q, strs, n)
+                                  : q_insert_head_bulk(current->q, strs, n);
+        current->size += cnt;
+        total += cnt;
+
+        /* Visit the new elements in the order they were inserted */
+        q_iter_t it;
+        element_t *entry = pos == POS_TAIL ? q_last(current->q, &it)
+                                           : q_first(current->q, &it);
+        for (int i = 1; entry && i < cnt; i++)
+            entry = pos == POS_TAIL ? q_prev(current->q, &it)
+                                    : q_next(current->q, &it);
+        for (int i = 0; ok && entry && i < cnt; i++) {
+            ok = check_inserted(entry, strs[i], lasts);
+            lasts = entry->value;
+            entry = pos == POS_TAIL ? q_next(current->q, &it)
+                                    : q_prev(current->q, &it);
+        }
+
+        /* A failed insertion consumes one repetition, as in queue_insert */
+        r += cnt;
+        if (ok && cnt < n) {
+            ok = insert_failed(strs[cnt]);
+            r++;
+        }
+        ok = ok && !error_check();
+    }
+
+    double elapsed = delta_time(&start);
+    report(2, "Inserted %d elements in %.3f seconds (%.0f insertions/sec)",
+           total, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+    return ok;
+}
+
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
@@ -224,6 +342,16 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    /* Repeated insertions go through the bulk interface */
+    if (current && current->q && reps > 1) {
+        if (exception_setup(true))
+            ok = queue_insert_bulk(pos, inserts, need_rand, reps);
+        exception_cancel();
+
+        q_show(3);
+        return ok;
+    }
+
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
@@ -232,38 +360,13 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                                         : q_insert_head(current->q, inserts);
             if (rval) {
                 current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
-                char *cur_inserts = entry->value;
-                if (!cur_inserts) {
-                    report(1, "ERROR: Failed to save copy of string in queue");
-                    ok = false;
-                } else if (r == 0 && inserts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate and copy string for new "
-                           "queue element");
-                    ok = false;
-                    break;
-                } else if (r == 1 && lasts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate separate string for each "
-                           "queue element");
-                    ok = false;
-                    break;
-                }
-                lasts = cur_inserts;
+                q_iter_t it;
+                element_t *entry = pos == POS_TAIL ? q_last(current->q, &it)
+                                                   : q_first(current->q, &it);
+                ok = check_inserted(entry, inserts, lasts);
+                lasts = entry->value;
             } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
-                }
+                ok = insert_failed(inserts);
             }
             ok = ok && !error_check();
         }
@@ -286,6 +389,88 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+/* Remove up to n elements at once through q_remove_head_n() or
+ * q_remove_tail_n(). Check that they are the ones at that end of the queue,
+ * in queue order, and that each holds expected unless it is "*".
+ */
+static bool queue_remove_batch(position_t pos, const char *expected, int n)
+{
+    bool ok = true;
+    int want = current ? (n < current->size ? n : current->size) : 0;
+    element_t **refs = malloc(sizeof(element_t *) * (want > 0 ? want : 1));
+    if (!refs) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for removal");
+        return false;
+    }
+
+    if (!want)
+        report(3, "Warning: Calling remove %s on empty queue",
+               pos == POS_TAIL ? "tail" : "head");
+    error_check();
+
+    /* Elements at the requested end, in queue order */
+    q_iter_t it;
+    element_t *entry = NULL;
+    if (want)
+        entry = pos == POS_TAIL ? q_last(current->q, &it)
+                                : q_first(current->q, &it);
+    for (int i = 0; entry && i < want; i++) {
+        refs[pos == POS_TAIL ? want - 1 - i : i] = entry;
+        entry = pos == POS_TAIL ? q_prev(current->q, &it)
+                                : q_next(current->q, &it);
+    }
+
+    LIST_HEAD(removed);
+    int cnt = 0;
+    double start;
+    init_time(&start);
+    if (current && exception_setup(true))
+        cnt = pos == POS_TAIL ? q_remove_tail_n(current->q, n, &removed)
+                              : q_remove_head_n(current->q, n, &removed);
+    exception_cancel();
+    double elapsed = delta_time(&start);
+
+    int len = 0;
+    bool same = true;
+    element_t *e, *safe;
+    list_for_each_entry_safe (e, safe, &removed, list) {
+        same = same && len < want && e == refs[len];
+        if (ok && strcmp(expected, "*") && strcmp(e->value, expected)) {
+            report(1, "ERROR: Removed value %s != expected value %s",
+                   e->value, expected);
+            ok = false;
+        }
+        q_release_element(e);
+        len++;
+    }
+    free(refs);
+    if (current)
+        current->size -= len;
+
+    if (cnt != len || cnt != want || !same) {
+        report(1,
+               "ERROR: Removed %d elements (%d linked) instead of the %d at "
+               "%s of queue",
+               cnt, len, want, pos == POS_TAIL ? "tail" : "head");
+        ok = false;
+    } else if (!cnt) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Removal from queue failed");
+        } else {
+            report(1, "ERROR: Removal from queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    } else {
+        report(2, "Removed %d elements in %.3f seconds (%.0f removals/sec)",
+               cnt, elapsed, elapsed > 0 ? cnt / elapsed : 0.0);
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
     /* FIXME: It is known that both functions is_remove_tail_const() and
@@ -310,11 +495,20 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     }
 #endif
 
-    if (argc != 1 && argc != 2) {
-        report(1, "%s needs 0-1 arguments", argv[0]);
+    if (argc < 1 || argc > 3) {
+        report(1, "%s needs 0-2 arguments", argv[0]);
         return false;
     }
 
+    if (argc == 3) {
+        int n;
+        if (!get_int(argv[2], &n) || n < 1) {
+            report(1, "Invalid number of removals '%s'", argv[2]);
+            return false;
+        }
+        return queue_remove_batch(pos, argv[1], n);
+    }
+
     char *removes = malloc(string_length + STRINGPAD + 1);
     if (!removes) {
         report(1,
@@ -429,10 +623,11 @@ static bool do_dedup(int argc, char *argv[])
 
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
+    q_iter_t it;
 
     // Copy current->q to l_copy
-    if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
+    if (current->q && q_size(current->q)) {
+        q_for_each (item, current->q, it) {
             size_t slen;
             tmp = malloc(sizeof(element_t));
             if (!tmp)
@@ -448,7 +643,7 @@ static bool do_dedup(int argc, char *argv[])
             list_add_tail(&tmp->list, &l_copy);
         }
         // Return false if the loop does not leave properly
-        if (&item->list != current->q) {
+        if (item) {
             list_for_each_entry_safe (item, tmp, &l_copy, list) {
                 free(item->value);
                 free(item);
@@ -474,10 +669,10 @@ static bool do_dedup(int argc, char *argv[])
         return false;
     }
 
-    struct list_head *l_tmp = current->q->next;
+    element_t *l_tmp = q_first(current->q, &it);
     bool is_this_dup = false;
     // Compare between new list and old one
-    list_for_each_entry (item, &l_copy, list) {
+    list_for_each_entry_prefetch (item, &l_copy, list) {
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
             item->list.next != &l_copy &&
@@ -486,22 +681,20 @@ static bool do_dedup(int argc, char *argv[])
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
-        } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
+        } else if (l_tmp && strcmp(l_tmp->value, item->value) == 0)
+            l_tmp = q_next(current->q, &it);
         else
             ok = false;
         is_this_dup = is_next_dup;
     }
     // All elements in new list should be traversed
-    ok = ok && l_tmp == current->q;
+    ok = ok && !l_tmp;
     if (!ok)
         report(1,
                "ERROR: Duplicate strings are in queue or distinct strings are "
                "not in queue");
 
-    list_for_each_entry_safe (item, tmp, &l_copy, list) {
+    list_for_each_entry_safe_prefetch (item, tmp, &l_copy, list) {
         free(item->value);
         free(item);
     }
@@ -510,6 +703,115 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Entry of the reference computation of do_dedupu() */
+typedef struct {
+    char *value;
+    int idx;
+} dedupu_ref_t;
+
+static int dedupu_ref_cmp(const void *a, const void *b)
+{
+    const dedupu_ref_t *x = a, *y = b;
+    int cmp = strcmp(x->value, y->value);
+    return cmp ? cmp : x->idx - y->idx;
+}
+
+static bool do_dedupu(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+
+    /* Keep a copy of the strings in their original order, and mark the ones
+     * occurring more than once by sorting the copy
+     */
+    int cnt = q_size(current->q);
+    char **values = malloc(sizeof(char *) * (cnt ? cnt : 1));
+    dedupu_ref_t *ref = malloc(sizeof(dedupu_ref_t) * (cnt ? cnt : 1));
+    bool *dup = calloc(cnt ? cnt : 1, sizeof(bool));
+    int i = 0;
+    if (values && ref && dup) {
+        element_t *item;
+        q_iter_t it;
+        q_for_each (item, current->q, it) {
+            values[i] = strdup(item->value);
+            if (!values[i])
+                break;
+            ref[i].value = values[i];
+            ref[i].idx = i;
+            i++;
+        }
+    }
+    if (!values || !ref || !dup || i != cnt) {
+        while (i > 0)
+            free(values[--i]);
+        free(values);
+        free(ref);
+        free(dup);
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        return false;
+    }
+    qsort(ref, cnt, sizeof(dedupu_ref_t), dedupu_ref_cmp);
+    for (i = 1; i < cnt; i++) {
+        if (!strcmp(ref[i - 1].value, ref[i].value))
+            dup[ref[i - 1].idx] = dup[ref[i].idx] = true;
+    }
+
+    error_check();
+
+    bool ok = true;
+    double start, elapsed = 0;
+    if (exception_setup(true)) {
+        init_time(&start);
+        ok = q_delete_dup_unsorted(current->q);
+        elapsed = delta_time(&start);
+    }
+    exception_cancel();
+
+    if (!ok) {
+        report(1, "ERROR: Could not delete duplicates from queue");
+    } else {
+        int removed = 0;
+        q_iter_t it;
+        element_t *l_tmp = q_first(current->q, &it);
+        for (i = 0; i < cnt; i++) {
+            if (dup[i]) {
+                removed++;
+                continue;
+            }
+            if (!l_tmp || strcmp(l_tmp->value, values[i])) {
+                ok = false;
+                break;
+            }
+            l_tmp = q_next(current->q, &it);
+        }
+        ok = ok && !l_tmp;
+        if (!ok)
+            report(1,
+                   "ERROR: Duplicate strings are in queue or distinct strings "
+                   "are not in queue");
+        current->size -= removed;
+        report(2, "Deleted %d elements in %.3f seconds", removed, elapsed);
+    }
+
+    for (i = 0; i < cnt; i++)
+        free(values[i]);
+    free(values);
+    free(ref);
+    free(dup);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -579,6 +881,22 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Check whether the first cnt elements of q are in ascending or descending
+ * order
+ */
+static bool queue_is_sorted(struct list_head *q, int cnt, bool descend)
+{
+    q_iter_t it;
+    element_t *item = q_first(q, &it), *next_item;
+    for (; item && --cnt > 0 && (next_item = q_next(q, &it));
+         item = next_item) {
+        int cmp = strcmp(item->value, next_item->value);
+        if (descend ? cmp < 0 : cmp > 0)
+            return false;
+    }
+    return true;
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -604,32 +922,25 @@ bool do_sort(int argc, char *argv[])
     set_noallocate_mode(false);
 
     bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            /* Ensure each element in ascending/descending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
-                ok = false;
-                break;
-            }
-
-            if (descend && strcmp(item->value, next_item->value) < 0) {
-                report(1, "ERROR: Not sorted in descending order");
-                ok = false;
-                break;
-            }
-        }
+    if (current && current->size &&
+        !queue_is_sorted(current->q, current->size, descend)) {
+        report(1, "ERROR: Not sorted in %s order",
+               descend ? "descending" : "ascending");
+        ok = false;
     }
 
     q_show(3);
     return ok && !error_check();
 }
 
-static bool do_dm(int argc, char *argv[])
+static const char *sort_algo_names[Q_SORT_NR] = {
+    [Q_SORT_LIST_SORT] = "list_sort",
+    [Q_SORT_TOP_DOWN] = "top-down",
+    [Q_SORT_MULTIKEY] = "multikey",
+    [Q_SORT_NATURAL] = "natural",
+};
+
+static bool do_bench(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
@@ -637,108 +948,914 @@ static bool do_dm(int argc, char *argv[])
     }
 
     if (!current || !current->q) {
-        report(3, "Warning: Try to access null queue");
+        report(3, "Warning: Calling bench on null queue");
         return false;
     }
     error_check();
 
-    bool ok = true;
-    if (exception_setup(true))
-        ok = q_delete_mid(current->q);
-    exception_cancel();
-
-    if (!current->size)
-        report(3, "Warning: Try to delete middle node to empty queue");
-    else
-        --current->size;
-    q_show(3);
-    return ok && !error_check();
-}
-
-static bool do_swap(int argc, char *argv[])
-{
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    /* Every algorithm sorts a queue of its own, holding the strings of the
+     * current queue in their current order. The current queue is left as is.
+     */
+    int cnt = current->size;
+    char **values = malloc(sizeof(char *) * (cnt ? cnt : 1));
+    if (!values) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for benchmark");
         return false;
     }
 
-    if (!current || !current->q) {
-        report(3, "Warning: Try to access null queue");
-        return false;
+    int n = 0;
+    element_t *item;
+    q_iter_t it;
+    q_for_each (item, current->q, it) {
+        if (n == cnt)
+            break;
+        values[n++] = item->value;
     }
-    error_check();
 
-    set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_swap(current->q);
-    exception_cancel();
+    bool ok = true;
+    int algo = q_sort_algo;
+    for (int a = 0; ok && a < Q_SORT_NR; a++) {
+        struct list_head *q = q_new();
+        int inserted = 0;
+        while (q && inserted < n) {
+            int got = q_insert_tail_bulk(q, values + inserted, n - inserted);
+            if (!got)
+                break;
+            inserted += got;
+        }
 
-    set_noallocate_mode(false);
+        if (!q || inserted < n) {
+            report(1,
+                   "INTERNAL ERROR.  Could not allocate space for benchmark");
+            ok = false;
+        } else {
+            double start;
+            q_sort_algo = a;
+            q_cmp_count = q_merge_cmp_count = 0;
+            init_time(&start);
+            set_noallocate_mode(true);
+            if (exception_setup(true))
+                q_sort(q, descend);
+            exception_cancel();
+            set_noallocate_mode(false);
+            double elapsed = delta_time(&start);
+
+            if (error_check() || !queue_is_sorted(q, n, descend)) {
+                report(1, "ERROR: Failed to sort with %s", sort_algo_names[a]);
+                ok = false;
+            } else {
+                report(1,
+                       "%-12s %12lu comparisons (%lu merging) %10.3f seconds",
+                       sort_algo_names[a], q_cmp_count, q_merge_cmp_count,
+                       elapsed);
+            }
+        }
+
+        q_free(q);
+    }
+    q_sort_algo = algo;
+    free(values);
 
     q_show(3);
-    return !error_check();
+    return ok && !error_check();
 }
 
-
-static bool do_ascend(int argc, char *argv[])
+static bool do_walk(int argc, char *argv[])
 {
     if (argc != 1) {
-        report(1, "%s takes too much arguments", argv[0]);
+        report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling ascend on null queue");
+        report(3, "Warning: Calling walk on null queue");
         return false;
     }
     error_check();
 
+    /* The walks go through a list of elements of its own, sharing the
+     * strings of the current queue, so that the comparison is the same on
+     * every backend
+     */
+    int cnt = current->size;
+    element_t **nodes = malloc(sizeof(element_t *) * (cnt ? cnt : 1));
+    if (!nodes) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for walk");
+        return false;
+    }
 
-    int cnt = q_size(current->q);
-    if (!cnt)
-        report(3, "Warning: Calling ascend on empty queue");
-    else if (cnt < 2)
-        report(3, "Warning: Calling ascend on single node");
-    error_check();
-
-    if (exception_setup(true))
-        current->size = q_ascend(current->q);
-    set_noallocate_mode(false);
-
-    bool ok = true;
+    int n = 0;
+    element_t *item;
+    q_iter_t it;
+    q_for_each (item, current->q, it) {
+        if (n == cnt)
+            break;
+        element_t *e = malloc(sizeof(element_t));
+        if (!e)
+            break;
+        e->value = item->value;
+        nodes[n++] = e;
+    }
 
-    cnt = current->size;
-    if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
-                report(1,
-                       "ERROR: At least one node violated the ordering rule");
-                ok = false;
-                break;
-            }
+    bool ok = n == cnt;
+    if (!ok) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for walk");
+    } else {
+        /* Link the elements in random order, so that neighbors in the list
+         * lie apart in memory, as after sorting or long use of a queue
+         */
+        for (int i = n - 1; i > 0; i--) {
+            int j = rand() % (i + 1);
+            element_t *tmp = nodes[i];
+            nodes[i] = nodes[j];
+            nodes[j] = tmp;
+        }
+        LIST_HEAD(l);
+        for (int i = 0; i < n; i++)
+            list_add_tail(&nodes[i]->list, &l);
+
+        element_t *e;
+        double plain = 0, prefetch = 0;
+        double start;
+        init_time(&start);
+        list_for_each_entry (e, &l, list)
+            plain += shannon_entropy((const uint8_t *) e->value);
+        double plain_time = delta_time(&start);
+
+        init_time(&start);
+        list_for_each_entry_prefetch (e, &l, list)
+            prefetch += shannon_entropy((const uint8_t *) e->value);
+        double prefetch_time = delta_time(&start);
+
+        if (plain != prefetch) {
+            report(1, "ERROR: Walks visited different elements");
+            ok = false;
+        } else {
+            report(1, "%-12s %10.3f seconds", "plain", plain_time);
+            report(1, "%-12s %10.3f seconds (distance %d)", "prefetch",
+                   prefetch_time, LIST_PREFETCH_DISTANCE);
         }
     }
 
-    q_show(3);
+    for (int i = 0; i < n; i++)
+        free(nodes[i]);
+    free(nodes);
     return ok && !error_check();
 }
 
-static bool do_descend(int argc, char *argv[])
+/* Latency histogram of the stress command. Below LAT_SUB nanoseconds every
+ * value has a bucket of its own; above, each power of two is split into
+ * LAT_SUB buckets, which bounds the error of a percentile to 1/LAT_SUB.
+ */
+#define LAT_SUB 16
+#define LAT_BUCKETS (61 * LAT_SUB)
+
+static inline int lat_bucket(uint64_t ns)
 {
-    if (argc != 1) {
-        report(1, "%s takes too much arguments", argv[0]);
-        return false;
-    }
+    if (ns < LAT_SUB)
+        return ns;
+    int k = 63 - __builtin_clzll(ns);
+    return (k - 3) * LAT_SUB + ((ns >> (k - 4)) & (LAT_SUB - 1));
+}
 
-    if (!current || !current->q) {
-        report(3, "Warning: Calling descend on null queue");
-        return false;
-    }
-    error_check();
+/* Smallest value falling into bucket b */
+static inline uint64_t lat_value(int b)
+{
+    if (b < LAT_SUB)
+        return b;
+    return (uint64_t) (LAT_SUB + b % LAT_SUB) << (b / LAT_SUB - 1);
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * stress_queue_t - Queue the stress command may run on
+ * @name: description in reports
+ * @create: allocate an empty queue
+ * @destroy: free a queue and the elements it still holds
+ * @attach: get the handle a thread passes to @insert and @remove
+ * @detach: give back a handle
+ * @insert: insert a copy of a string at tail, like q_insert_tail()
+ * @remove: copy out and remove the string at head, like q_remove_head(),
+ *          returning false if the queue was empty
+ */
+typedef struct {
+    const char *name;
+    void *(*create)(void);
+    void (*destroy)(void *q);
+    void *(*attach)(void *q);
+    void (*detach)(void *h);
+    bool (*insert)(void *h, char *s);
+    bool (*remove)(void *h, char *sp, size_t bufsize);
+} stress_queue_t;
+
+static void *lockfree_create(void)
+{
+    return mpmc_new();
+}
+
+static void lockfree_destroy(void *q)
+{
+    mpmc_free(q);
+}
+
+static void *lockfree_attach(void *q)
+{
+    return mpmc_attach(q);
+}
+
+static void lockfree_detach(void *h)
+{
+    mpmc_detach(h);
+}
+
+static bool lockfree_insert(void *h, char *s)
+{
+    return mpmc_insert_tail(h, s);
+}
+
+static bool lockfree_remove(void *h, char *sp, size_t bufsize)
+{
+    element_t *e = mpmc_remove_head(h, sp, bufsize);
+    if (!e)
+        return false;
+    q_release_element(e);
+    return true;
+}
+
+static void *twolock_create(void)
+{
+    return twolock_new();
+}
+
+static void twolock_destroy(void *q)
+{
+    twolock_free(q);
+}
+
+/* Threads share the queue itself as handle */
+static void *shared_attach(void *q)
+{
+    return q;
+}
+
+static void shared_detach(void *h) {}
+
+static bool twolock_insert(void *h, char *s)
+{
+    return twolock_insert_tail(h, s);
+}
+
+static bool twolock_remove(void *h, char *sp, size_t bufsize)
+{
+    return twolock_remove_head(h, sp, bufsize);
+}
+
+/* A queue of the backend under test behind a single mutex */
+typedef struct {
+    struct list_head *head;
+    pthread_mutex_t lock;
+} locked_queue_t;
+
+static void *locked_create(void)
+{
+    locked_queue_t *q = malloc(sizeof(locked_queue_t));
+    if (!q)
+        return NULL;
+    q->head = q_new();
+    if (!q->head) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    return q;
+}
+
+static void locked_destroy(void *q)
+{
+    locked_queue_t *lq = q;
+    if (!lq)
+        return;
+    q_free(lq->head);
+    pthread_mutex_destroy(&lq->lock);
+    free(lq);
+}
+
+static bool locked_insert(void *h, char *s)
+{
+    locked_queue_t *lq = h;
+    pthread_mutex_lock(&lq->lock);
+    bool ok = q_insert_tail(lq->head, s);
+    pthread_mutex_unlock(&lq->lock);
+    return ok;
+}
+
+static bool locked_remove(void *h, char *sp, size_t bufsize)
+{
+    locked_queue_t *lq = h;
+    pthread_mutex_lock(&lq->lock);
+    element_t *e = q_remove_head(lq->head, sp, bufsize);
+    pthread_mutex_unlock(&lq->lock);
+    if (!e)
+        return false;
+    q_release_element(e);
+    return true;
+}
+
+/* Indexed by the stress_queue option */
+static const stress_queue_t stress_queues[] = {
+    {"lock-free", lockfree_create, lockfree_destroy, lockfree_attach,
+     lockfree_detach, lockfree_insert, lockfree_remove},
+    {"two-lock", twolock_create, twolock_destroy, shared_attach,
+     shared_detach, twolock_insert, twolock_remove},
+    {"global lock", locked_create, locked_destroy, shared_attach,
+     shared_detach, locked_insert, locked_remove},
+};
+
+#define NR_STRESS_QUEUES \
+    (int) (sizeof(stress_queues) / sizeof(stress_queues[0]))
+
+/**
+ * stress_t - State shared by the threads of the stress command
+ * @ops: operations of @q
+ * @q: queue under test
+ * @producers: number of producer threads
+ * @total: number of elements to pass through @q
+ * @removed: number of elements removed so far
+ * @errors: number of removed strings failing a check
+ * @seen: bitmap of the removed strings, indexed as in stress_index()
+ * @stop: set to make every worker return early, when a thread could not be
+ *        started or a worker gave up allocating
+ */
+typedef struct {
+    const stress_queue_t *ops;
+    void *q;
+    int producers;
+    long total;
+    atomic_long removed;
+    atomic_long errors;
+    atomic_ulong *seen;
+    atomic_bool stop;
+} stress_t;
+
+/* Failed allocations in a row after which a worker gives up */
+#define STRESS_RETRIES 1000
+
+/**
+ * stress_worker_t - Producer or consumer thread of the stress command
+ * @s: shared state
+ * @id: index among the producers, or -1 for a consumer
+ * @last: for a consumer, the last sequence number removed per producer
+ * @ops: number of insertions or removals done
+ * @failures: number of failed allocations, which are retried up to
+ *            STRESS_RETRIES times in a row
+ * @max: longest latency, in nanoseconds
+ * @hist: latency histogram
+ */
+typedef struct {
+    stress_t *s;
+    int id;
+    long *last;
+    pthread_t thread;
+    bool started;
+    long ops, failures;
+    uint64_t max;
+    uint64_t hist[LAT_BUCKETS];
+} stress_worker_t;
+
+/* Number of strings producer p inserts. The last one takes the remainder. */
+static inline long stress_share(const stress_t *s, int p)
+{
+    long share = s->total / s->producers;
+    return p == s->producers - 1 ? s->total - share * p : share;
+}
+
+/* Bit of seq of producer p in stress_t.seen */
+static inline long stress_index(const stress_t *s, int p, long seq)
+{
+    return s->total / s->producers * p + seq;
+}
+
+static inline void stress_record(stress_worker_t *w, uint64_t ns)
+{
+    w->hist[lat_bucket(ns)]++;
+    if (ns > w->max)
+        w->max = ns;
+    w->ops++;
+}
+
+/* Count a failed allocation of w, the row-th in a row. Return false after
+ * stopping every worker once there were too many.
+ */
+static bool stress_retry(stress_worker_t *w, int *row)
+{
+    w->failures++;
+    if (++*row < STRESS_RETRIES)
+        return true;
+    atomic_store(&w->s->stop, true);
+    return false;
+}
+
+/* Insert "p:seq" for seq counting up from 0, so that consumers can check
+ * that each string is removed once and in the order of its producer.
+ */
+static void stress_produce(stress_worker_t *w, void *h)
+{
+    char buf[32];
+    long share = stress_share(w->s, w->id);
+    int row = 0;
+
+    for (long seq = 0; seq < share && !atomic_load(&w->s->stop);) {
+        snprintf(buf, sizeof(buf), "%d:%ld", w->id, seq);
+        uint64_t start = now_ns();
+        bool ok = w->s->ops->insert(h, buf);
+        uint64_t end = now_ns();
+        if (!ok) {
+            if (!stress_retry(w, &row))
+                return;
+            continue;
+        }
+        row = 0;
+        stress_record(w, end - start);
+        seq++;
+    }
+}
+
+static void stress_consume(stress_worker_t *w, void *h)
+{
+    stress_t *s = w->s;
+    char buf[32];
+
+    while (!atomic_load(&s->stop) && atomic_load(&s->removed) < s->total) {
+        uint64_t start = now_ns();
+        bool ok = s->ops->remove(h, buf, sizeof(buf));
+        uint64_t end = now_ns();
+        if (!ok) {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add(&s->removed, 1);
+        stress_record(w, end - start);
+
+        char *sep;
+        long p = strtol(buf, &sep, 10), seq = -1;
+        if (*sep == ':')
+            seq = strtol(sep + 1, NULL, 10);
+        if (p < 0 || p >= s->producers || seq < 0 ||
+            seq >= stress_share(s, p) || seq <= w->last[p]) {
+            atomic_fetch_add(&s->errors, 1);
+            continue;
+        }
+        w->last[p] = seq;
+
+        long i = stress_index(s, p, seq);
+        unsigned long bit = 1UL << (i % 64);
+        if (atomic_fetch_or(&s->seen[i / 64], bit) & bit)
+            atomic_fetch_add(&s->errors, 1);
+    }
+}
+
+static void *stress_worker(void *arg)
+{
+    stress_worker_t *w = arg;
+    const stress_queue_t *ops = w->s->ops;
+    void *h;
+
+    /* Handles come from the harness, whose allocations may fail */
+    int row = 0;
+    while (!(h = ops->attach(w->s->q))) {
+        if (!stress_retry(w, &row))
+            return NULL;
+    }
+    if (w->id >= 0)
+        stress_produce(w, h);
+    else
+        stress_consume(w, h);
+    ops->detach(h);
+    return NULL;
+}
+
+/* Report the percentiles of the merged histograms of workers [lo, hi) */
+static void stress_report(const char *what,
+                          stress_worker_t *workers,
+                          int lo,
+                          int hi)
+{
+    static const double pct[] = {50, 90, 99, 99.9};
+    uint64_t hist[LAT_BUCKETS] = {0}, max = 0;
+    long count = 0;
+
+    for (int i = lo; i < hi; i++) {
+        for (int b = 0; b < LAT_BUCKETS; b++)
+            hist[b] += workers[i].hist[b];
+        if (workers[i].max > max)
+            max = workers[i].max;
+        count += workers[i].ops;
+    }
+
+    uint64_t val[4] = {0};
+    long seen = 0;
+    for (int b = 0, j = 0; b < LAT_BUCKETS && j < 4; b++) {
+        seen += hist[b];
+        while (j < 4 && seen && seen >= count * pct[j] / 100)
+            val[j++] = lat_value(b);
+    }
+    report(1,
+           "%s latency (ns): p50 %lu, p90 %lu, p99 %lu, p99.9 %lu, max %lu",
+           what, (unsigned long) val[0], (unsigned long) val[1],
+           (unsigned long) val[2], (unsigned long) val[3],
+           (unsigned long) max);
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    if (argc != 3 && argc != 4) {
+        report(1, "%s takes 2-3 arguments", argv[0]);
+        return false;
+    }
+
+    int producers, consumers, total = 100000;
+    if (!get_int(argv[1], &producers) || !get_int(argv[2], &consumers) ||
+        (argc == 4 && !get_int(argv[3], &total)) || producers < 1 ||
+        consumers < 1 || producers + consumers > MPMC_MAX_THREADS ||
+        total < 1) {
+        report(1,
+               "Invalid arguments to %s: need 1 to %d threads in all and at "
+               "least one element",
+               argv[0], MPMC_MAX_THREADS);
+        return false;
+    }
+    if (stress_queue < 0 || stress_queue >= NR_STRESS_QUEUES) {
+        report(1, "Unknown stress queue %d", stress_queue);
+        return false;
+    }
+    error_check();
+
+    int nr = producers + consumers;
+    stress_t s = {
+        .ops = &stress_queues[stress_queue],
+        .producers = producers,
+        .total = total,
+    };
+    atomic_init(&s.removed, 0);
+    atomic_init(&s.errors, 0);
+    atomic_init(&s.stop, false);
+    s.seen = calloc((total + 63) / 64, sizeof(atomic_ulong));
+    stress_worker_t *workers = calloc(nr, sizeof(stress_worker_t));
+    long *last = malloc(sizeof(long) * producers * consumers);
+    s.q = s.ops->create();
+    if (!s.seen || !workers || !last || !s.q) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for stress");
+        if (s.q)
+            s.ops->destroy(s.q);
+        free(s.seen);
+        free(workers);
+        free(last);
+        return false;
+    }
+    for (int i = 0; i < producers * consumers; i++)
+        last[i] = -1;
+
+    /* Interning is not thread-safe. SIGALRM stays blocked while the workers
+     * run, since the time limit cannot unwind their stacks.
+     */
+    int intern = q_intern;
+    q_intern = 0;
+    set_threaded_mode(true);
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    /* Workers that did start would wait for missing producers, so a thread
+     * that cannot be created stops them all
+     */
+    double start;
+    init_time(&start);
+    bool started = true;
+    for (int i = 0; i < nr && started; i++) {
+        stress_worker_t *w = &workers[i];
+        w->s = &s;
+        w->id = i < producers ? i : -1;
+        w->last = last + (i - producers) * producers;
+        w->started = started =
+            !pthread_create(&w->thread, NULL, stress_worker, w);
+    }
+    if (!started)
+        atomic_store(&s.stop, true);
+    for (int i = 0; i < nr; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+    }
+    double elapsed = delta_time(&start);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    set_threaded_mode(false);
+    q_intern = intern;
+
+    bool ok = !atomic_load(&s.stop);
+    if (!started) {
+        report(1, "ERROR: Could not start %d threads", nr);
+    } else if (!ok) {
+        report(1, "ERROR: Gave up after %d failed allocations in a row",
+               STRESS_RETRIES);
+    }
+    if (!ok) {
+        s.ops->destroy(s.q);
+        free(s.seen);
+        free(workers);
+        free(last);
+        return false;
+    }
+
+    long failures = 0, missing = 0;
+    for (int i = 0; i < nr; i++)
+        failures += workers[i].failures;
+    for (long i = 0; i < total; i++)
+        missing += !(atomic_load(&s.seen[i / 64]) & (1UL << (i % 64)));
+
+    report(1,
+           "%s, %d producers, %d consumers: %d elements in %.3f seconds "
+           "(%.0f ops/sec)",
+           s.ops->name, producers, consumers, total, elapsed,
+           elapsed > 0 ? 2 * total / elapsed : 0.0);
+    stress_report("Insert", workers, 0, producers);
+    stress_report("Remove", workers, producers, nr);
+    if (failures)
+        report(2, "%ld allocations failed and were retried", failures);
+    if (atomic_load(&s.errors) || missing) {
+        report(1,
+               "ERROR: %ld strings removed twice or out of order, %ld never "
+               "removed",
+               atomic_load(&s.errors), missing);
+        ok = false;
+    }
+
+    s.ops->destroy(s.q);
+    free(s.seen);
+    free(workers);
+    free(last);
+    return ok && !error_check();
+}
+
+static bool do_dm(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_delete_mid(current->q);
+    exception_cancel();
+
+    if (!current->size)
+        report(3, "Warning: Try to delete middle node to empty queue");
+    else
+        --current->size;
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Parse the position argument of at and delat, which must be within the
+ * current queue
+ */
+static bool get_position(int argc, char *argv[], int *pos)
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], pos)) {
+        report(1, "Invalid position '%s'", argv[1]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    if (*pos < 0 || *pos >= current->size) {
+        report(1, "Position %d is out of range [0, %d)", *pos, current->size);
+        return false;
+    }
+    return true;
+}
+
+static bool do_at(int argc, char *argv[])
+{
+    int pos;
+    if (!get_position(argc, argv, &pos))
+        return false;
+    error_check();
+
+    element_t *e = NULL;
+    q_iter_t it;
+    if (exception_setup(true))
+        e = q_at(current->q, pos, &it);
+    exception_cancel();
+
+    if (!e) {
+        report(1, "ERROR: No element found at position %d", pos);
+        return false;
+    }
+    report(1, "Element %d = %s", pos, e->value);
+
+    bool ok = true;
+    if (argc == 3 && strcmp(e->value, argv[2])) {
+        report(1, "ERROR: Found value %s != expected value %s", e->value,
+               argv[2]);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_delat(int argc, char *argv[])
+{
+    int pos;
+    if (!get_position(argc, argv, &pos))
+        return false;
+
+    char *removes = malloc(string_length + STRINGPAD + 1);
+    if (!removes) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        return false;
+    }
+    removes[0] = '\0';
+    memset(removes + 1, 'X', string_length + STRINGPAD - 1);
+    removes[string_length + STRINGPAD] = '\0';
+    error_check();
+
+    element_t *re = NULL;
+    if (exception_setup(true))
+        re = q_remove_at(current->q, pos, removes, string_length + 1);
+    exception_cancel();
+
+    bool ok = true;
+    if (!re) {
+        report(1, "ERROR: Removal at position %d failed", pos);
+        ok = false;
+    } else {
+        q_release_element(re);
+        current->size--;
+
+        /* As for rh and rt, the padding must still be intact */
+        int i = string_length + 1;
+        while ((i < string_length + STRINGPAD) && (removes[i] == 'X'))
+            i++;
+        if (i != string_length + STRINGPAD) {
+            report(1,
+                   "ERROR: copying of string in remove_at overflowed "
+                   "destination buffer.");
+            ok = false;
+        } else {
+            report(2, "Removed %s from queue", removes);
+        }
+        if (ok && argc == 3 && strcmp(removes, argv[2])) {
+            report(1, "ERROR: Removed value %s != expected value %s", removes,
+                   argv[2]);
+            ok = false;
+        }
+    }
+
+    q_show(3);
+    free(removes);
+    return ok && !error_check();
+}
+
+static bool do_range(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    int from, to;
+    if (!get_int(argv[1], &from) || !get_int(argv[2], &to) || from < 0 ||
+        to < from) {
+        report(1, "Invalid range [%s, %s)", argv[1], argv[2]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    if (to > current->size)
+        to = current->size;
+    if (from > to)
+        from = to;
+    error_check();
+
+    /* Shown like the queue itself, up to BIG_LIST_SIZE elements */
+    bool ok = true;
+    int cnt = 0;
+    report_noreturn(1, "l[%d:%d] = [", from, to);
+    if (exception_setup(true)) {
+        q_iter_t it;
+        element_t *e = from < to ? q_at(current->q, from, &it) : NULL;
+        for (; e && from + cnt < to; e = q_next(current->q, &it)) {
+            if (cnt < BIG_LIST_SIZE)
+                report_noreturn(1, cnt ? " %s" : "%s", e->value);
+            cnt++;
+        }
+    }
+    exception_cancel();
+    report(1, "%s", cnt > BIG_LIST_SIZE ? " ... ]" : "]");
+
+    if (from + cnt != to) {
+        report(1, "ERROR: Found %d elements in range instead of %d", cnt,
+               to - from);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_swap(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_swap(current->q);
+    exception_cancel();
+
+    set_noallocate_mode(false);
+
+    q_show(3);
+    return !error_check();
+}
+
+
+static bool do_ascend(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes too much arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling ascend on null queue");
+        return false;
+    }
+    error_check();
+
+
+    int cnt = q_size(current->q);
+    if (!cnt)
+        report(3, "Warning: Calling ascend on empty queue");
+    else if (cnt < 2)
+        report(3, "Warning: Calling ascend on single node");
+    error_check();
+
+    if (exception_setup(true))
+        current->size = q_ascend(current->q);
+    set_noallocate_mode(false);
+
+    bool ok = true;
+
+    if (current->size &&
+        !queue_is_sorted(current->q, current->size, false)) {
+        report(1, "ERROR: At least one node violated the ordering rule");
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_descend(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes too much arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling descend on null queue");
+        return false;
+    }
+    error_check();
 
 
     int cnt = q_size(current->q);
@@ -754,20 +1871,10 @@ static bool do_descend(int argc, char *argv[])
 
     bool ok = true;
 
-    cnt = current->size;
-    if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
-                report(1,
-                       "ERROR: At least one node violated the ordering rule");
-                ok = false;
-                break;
-            }
-        }
+    if (current->size &&
+        !queue_is_sorted(current->q, current->size, true)) {
+        report(1, "ERROR: At least one node violated the ordering rule");
+        ok = false;
     }
 
     q_show(3);
@@ -817,14 +1924,29 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    /* The other queues are freed below, so merging must keep every element */
+    int total = 0;
+    queue_contex_t *entry;
+    list_for_each_entry (entry, &chain.head, chain)
+        total += entry->size;
+
     int len = 0;
+    unsigned long cmp_count = q_merge_cmp_count;
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         len = q_merge(&chain.head, descend);
     exception_cancel();
     set_noallocate_mode(false);
+    report(2, "Merged %d elements with %lu comparisons", len,
+           q_merge_cmp_count - cmp_count);
+
+    bool ok = true;
+    if (len != total) {
+        report(1, "ERROR: Merged %d elements out of %d", len, total);
+        ok = false;
+    }
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -841,56 +1963,212 @@ static bool do_merge(int argc, char *argv[])
         current->chain.next = &chain.head;
     }
 
-    bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
-            /* Ensure each element in ascending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
-                report(1,
-                       "ERROR: Not sorted in ascending order (It might because "
-                       "of unsorted queues are merged or there're some flaws "
-                       "in 'q_merge')");
-                ok = false;
-                break;
-            }
+    if (current && current->size &&
+        !queue_is_sorted(current->q, len, descend)) {
+        report(1,
+               "ERROR: Not sorted in %s order (It might because of unsorted "
+               "queues are merged or there're some flaws in 'q_merge')",
+               descend ? "descending" : "ascending");
+        ok = false;
+    }
 
+    q_show(3);
+    return ok && !error_check();
+}
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
-                report(
-                    1,
-                    "ERROR: Not sorted in descending order (It might because "
-                    "of unsorted queues are merged or there're some flaws "
-                    "in 'q_merge')");
-                ok = false;
-                break;
-            }
+/* Check that a queue starts with first and ends with last, both NULL for an
+ * empty queue
+ */
+static bool queue_has_ends(struct list_head *q,
+                           element_t *first,
+                           element_t *last)
+{
+    q_iter_t it;
+    return q_first(q, &it) == first && q_last(q, &it) == last;
+}
+
+/* Move every element of queue src to the head or the tail of queue dst */
+static bool move_queue(queue_contex_t *dst, queue_contex_t *src, bool at_head)
+{
+    /* The elements of a go before those of b */
+    queue_contex_t *a = at_head ? src : dst, *b = at_head ? dst : src;
+    q_iter_t it;
+    element_t *first = q_first(a->q, &it), *last = q_last(b->q, &it);
+    if (!first)
+        first = q_first(b->q, &it);
+    if (!last)
+        last = q_last(a->q, &it);
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = at_head ? q_splice(dst->q, src->q) : q_concat(dst->q, src->q);
+    exception_cancel();
+    if (!ok) {
+        report(1, "ERROR: Could not move elements of queue %d to queue %d",
+               src->id, dst->id);
+        return false;
+    }
+
+    dst->size += src->size;
+    src->size = 0;
+    if (q_size(dst->q) != dst->size || q_size(src->q) ||
+        !queue_has_ends(dst->q, first, last)) {
+        report(1, "ERROR: Elements of queue %d were not moved to queue %d",
+               src->id, dst->id);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool do_splice(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling splice on null queue");
+        return false;
+    }
+    if (chain.size < 2) {
+        report(1, "There is no other queue to splice into");
+        return false;
+    }
+    error_check();
+
+    struct list_head *next = (current->chain.next == &chain.head)
+                                 ? chain.head.next
+                                 : current->chain.next;
+    queue_contex_t *dst = list_entry(next, queue_contex_t, chain);
+    bool ok = move_queue(dst, current, true);
+    current = dst;
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_concat(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    int id;
+    if (!get_int(argv[1], &id)) {
+        report(1, "Invalid queue ID '%s'", argv[1]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling concat on null queue");
+        return false;
+    }
+
+    queue_contex_t *src = NULL, *ctx;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if (ctx->id == id) {
+            src = ctx;
+            break;
         }
     }
+    if (!src || src == current) {
+        report(1, "There is no other queue with ID %d", id);
+        return false;
+    }
+    error_check();
+
+    bool ok = move_queue(current, src, false);
 
     q_show(3);
     return ok && !error_check();
 }
 
-static bool is_circular()
+static bool do_split(int argc, char *argv[])
 {
-    struct list_head *cur = current->q->next;
-    while (cur != current->q) {
-        if (!cur)
-            return false;
-        cur = cur->next;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
     }
 
-    cur = current->q->prev;
-    while (cur != current->q) {
-        if (!cur)
-            return false;
-        cur = cur->prev;
+    int k;
+    if (!get_int(argv[1], &k)) {
+        report(1, "Invalid position '%s'", argv[1]);
+        return false;
     }
-    return true;
+    if (!current || !current->q) {
+        report(3, "Warning: Calling split on null queue");
+        return false;
+    }
+    if (k < 0 || k > current->size) {
+        report(1, "Position %d is out of range [0, %d]", k, current->size);
+        return false;
+    }
+    error_check();
+
+    /* The elements on either side of the cut */
+    q_iter_t it;
+    element_t *first = q_first(current->q, &it);
+    element_t *last = q_last(current->q, &it);
+    element_t *before = k ? q_at(current->q, k - 1, &it) : NULL;
+    element_t *after = k < current->size ? q_at(current->q, k, &it) : NULL;
+
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    struct list_head *q = qctx ? q_new() : NULL;
+    if (!q) {
+        free(qctx);
+        report(1, "ERROR: Could not allocate a new queue");
+        return false;
+    }
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_split(current->q, k, q);
+    exception_cancel();
+
+    /* The new queue joins the chain even if empty, as with new */
+    qctx->q = q;
+    qctx->size = 0;
+    qctx->id = chain.size++;
+    list_add_tail(&qctx->chain, &chain.head);
+    queue_contex_t *src = current;
+    current = qctx;
+
+    if (!ok) {
+        report(1, "ERROR: Could not split queue %d at position %d", src->id,
+               k);
+    } else {
+        qctx->size = src->size - k;
+        src->size = k;
+        if (q_size(src->q) != src->size || q_size(q) != qctx->size ||
+            !queue_has_ends(src->q, k ? first : NULL, before) ||
+            !queue_has_ends(q, after, after ? last : NULL)) {
+            report(1, "ERROR: Queue %d was not split at position %d", src->id,
+                   k);
+            ok = false;
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Walk the queue in both directions, at most one element past its expected
+ * size. A broken link ends one of the walks early.
+ */
+static bool is_circular()
+{
+    q_iter_t it;
+    element_t *e;
+    int fwd = 0, bwd = 0;
+
+    for (e = q_first(current->q, &it); e && fwd <= current->size;
+         e = q_next(current->q, &it))
+        fwd++;
+    for (e = q_last(current->q, &it); e && bwd <= current->size;
+         e = q_prev(current->q, &it))
+        bwd++;
+    return fwd == bwd;
 }
 
 static bool q_show(int vlevel)
@@ -912,12 +2190,11 @@ static bool q_show(int vlevel)
 
     report_noreturn(vlevel, "l = [");
 
-    struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    q_iter_t it;
+    element_t *e = q_first(current->q, &it);
 
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < current->size) {
-            element_t *e = list_entry(cur, element_t, list);
+        while (ok && e && cnt < current->size) {
             if (cnt < BIG_LIST_SIZE) {
                 report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
                 if (show_entropy) {
@@ -927,7 +2204,7 @@ static bool q_show(int vlevel)
                 }
             }
             cnt++;
-            cur = cur->next;
+            e = q_next(current->q, &it);
             ok = ok && !error_check();
         }
     }
@@ -938,7 +2215,7 @@ static bool q_show(int vlevel)
         return false;
     }
 
-    if (cur == ori) {
+    if (!e) {
         if (cnt <= BIG_LIST_SIZE)
             report(vlevel, "]");
         else
@@ -953,6 +2230,26 @@ static bool q_show(int vlevel)
     return ok;
 }
 
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    size_t peak, bytes = allocation_bytes(&peak);
+    report(1, "%zu bytes in %zu blocks (peak %zu bytes)", bytes,
+           allocation_check(), peak);
+
+    long total = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain)
+        total += ctx->size;
+    if (total)
+        report(1, "%.1f bytes per element", (double) bytes / total);
+    return true;
+}
+
 static bool do_show(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -1026,21 +2323,60 @@ static void console_init()
                 "Insert string str at tail of queue n times. Generate random "
                 "string(s) if str equals RAND. (default: n == 1)",
                 "str [n]");
-    ADD_COMMAND(
-        rh,
-        "Remove from head of queue. Optionally compare to expected value str",
-        "[str]");
-    ADD_COMMAND(
-        rt,
-        "Remove from tail of queue. Optionally compare to expected value str",
-        "[str]");
+    ADD_COMMAND(rh,
+                "Remove from head of queue. Optionally compare to expected "
+                "value str, or remove n elements at once, each compared to "
+                "str unless it equals *",
+                "[str [n]]");
+    ADD_COMMAND(rt,
+                "Remove from tail of queue. Optionally compare to expected "
+                "value str, or remove n elements at once, each compared to "
+                "str unless it equals *",
+                "[str [n]]");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
+    ADD_COMMAND(bench,
+                "Sort copies of queue with every sorting algorithm and report "
+                "comparisons and time",
+                "");
+    ADD_COMMAND(walk,
+                "Walk a copy of queue in shuffled memory order, with and "
+                "without prefetching, and report time",
+                "");
+    ADD_COMMAND(stress,
+                "Pass n elements (default: n == 100000) from P producer to C "
+                "consumer threads through a concurrent queue",
+                "P C [n]");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(mem,
+                "Show allocated bytes and blocks, and the peak since the last "
+                "call",
+                "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
+    ADD_COMMAND(at, "Show element at position i, checking its value if given",
+                "i [str]");
+    ADD_COMMAND(delat,
+                "Remove element at position i, checking its value if given",
+                "i [str]");
+    ADD_COMMAND(range, "Show elements at positions [a, b)", "a b");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(dedupu,
+                "Delete all nodes that have duplicate string, in any order",
+                "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(splice,
+                "Move all elements of queue to the head of the next queue in "
+                "the chain, which becomes the current one",
+                "");
+    ADD_COMMAND(split,
+                "Keep the first k elements of queue and move the others to a "
+                "new queue, which becomes the current one",
+                "k");
+    ADD_COMMAND(concat,
+                "Move all elements of the queue with ID id to the tail of "
+                "queue",
+                "id");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(ascend,
                 "Remove every node which has a node with a strictly less "
@@ -1060,6 +2396,32 @@ static void console_init()
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("cqueue", &stress_queue,
+              "Queue of stress: 0 lock-free, 1 two locks, 2 one lock around "
+              "the q_* functions",
+              NULL);
+    add_param("compact", &q_compact,
+              "Allocate each element and its string in a single block", NULL);
+    add_param("sso", &q_sso_max,
+              "Longest string stored in the block of its element regardless "
+              "of 'compact'",
+              NULL);
+    add_param("intern", &q_intern,
+              "Share one reference-counted copy of each distinct string",
+              NULL);
+    add_param("sortalgo", &q_sort_algo,
+              "Sorting algorithm (0: list_sort, 1: top-down merge sort, 2: "
+              "multikey quicksort, 3: natural merge sort)",
+              NULL);
+    add_param("gallop", &q_gallop,
+              "Let merges move runs of nodes from the same queue at once",
+              NULL);
+    add_param("index", &q_index,
+              "Find positions through a skip list built over the queue", NULL);
+    add_param("threads", &q_sort_threads,
+              "Number of threads used by merge sorts and merge", NULL);
+    add_param("time", &time_limit,
+              "Number of seconds a queue operation may take", NULL);
 }
 
 /* Signal handlers */
@@ -1092,8 +2454,6 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
@@ -1107,7 +2467,6 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
-    set_cautious_mode(true);
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -5,10 +5,14 @@
  * operations.
  *
  * It uses a circular doubly-linked list to represent the set of queue elements
+ * (queue.c). Other backends (queue_*.c) implement the same interface with
+ * different representations; they keep element_t for the elements but treat
+ * the returned list head as an opaque handle.
  */
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
@@ -17,14 +21,53 @@
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
- *
- * @value needs to be explicitly allocated and freed
+ * @key: first 8 bytes of @value packed big-endian, zero-padded
+ * @inline_value: string storage for elements in compact layout
+ *
+ * @value needs to be explicitly allocated and freed, unless the element was
+ * created in compact layout (see q_compact and q_sso_max) or with interning
+ * (see q_intern). In compact layout the string bytes follow the element in the
+ * same allocation and @value points at @inline_value. An interned @value is
+ * shared with every other element holding the same string and must not be
+ * modified.
+ *
+ * @key is only present when built with QUEUE_KEY_PREFIX ("make
+ * KEY_PREFIX=1"). Comparing two keys as integers orders the elements like
+ * comparing the first 8 bytes of their strings, so most comparisons finish
+ * without dereferencing @value.
  */
 typedef struct {
     char *value;
     struct list_head list;
+#ifdef QUEUE_KEY_PREFIX
+    uint64_t key;
+#endif
+    char inline_value[];
 } element_t;
 
+struct skiplist;
+
+/**
+ * queue_head_t - Header of a queue
+ * @head: list head linking the elements of the queue
+ * @size: the number of elements in the queue
+ * @index: order-statistic index of the elements (see q_index), or NULL
+ * @index_stale: whether @index no longer matches the order of the elements
+ *
+ * q_new() hands out a pointer to @head, so list.h helpers and macros operate
+ * on the queue as on any other list. The q_* functions find @size through
+ * container_of() and keep it up to date, which makes q_size() O(1). Code
+ * relinking elements of a queue by other means must not change their number,
+ * nor their order while the queue has an index.
+ * Only queue.c uses this header.
+ */
+typedef struct {
+    struct list_head head;
+    int size;
+    struct skiplist *index;
+    bool index_stale;
+} queue_head_t;
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -39,11 +82,134 @@ typedef struct {
     int id;
 } queue_contex_t;
 
+/* Tunables, registered as options by qtest */
+
+/**
+ * q_compact - Allocate elements in compact layout
+ *
+ * When nonzero, q_insert_head() and q_insert_tail() obtain the element and a
+ * copy of its string with a single allocation, which halves the number of
+ * allocations per element and keeps the string next to its list node.
+ * Elements of both layouts may coexist in one queue.
+ */
+extern int q_compact;
+
+/**
+ * q_sso_max - Length of the longest string always stored inline, default 15
+ *
+ * Short strings get the compact layout even when q_compact is zero, so the
+ * common case of short values takes a single allocation and comparing them
+ * touches no memory outside their elements. Whether a string is stored
+ * inline is told by q_element_is_compact(). Zero disables this.
+ */
+extern int q_sso_max;
+
+/**
+ * q_intern - Share the strings of elements
+ *
+ * When nonzero, q_insert_head() and q_insert_tail() look the string up in a
+ * table of interned strings and make the element refer to the copy found
+ * there, which counts its references, instead of allocating a copy of its
+ * own. Queues holding the same few strings many times over then need one
+ * allocation per element instead of two, and much less memory. Takes
+ * precedence over q_compact and q_sso_max.
+ */
+extern int q_intern;
+
+/* Algorithms implementing q_sort() */
+enum {
+    Q_SORT_LIST_SORT, /* list_sort() of list.h, as in the Linux kernel */
+    Q_SORT_TOP_DOWN,  /* Recursive top-down merge sort */
+    Q_SORT_MULTIKEY,  /* Multikey quicksort on an array of element pointers */
+    Q_SORT_NATURAL,   /* Natural merge sort with galloping, after TimSort */
+    Q_SORT_NR,
+};
+
+/**
+ * q_sort_algo - Select the algorithm used by q_sort(), default
+ * Q_SORT_NATURAL
+ *
+ * Backends other than queue.c accept the option but use an algorithm suited
+ * to their representation.
+ */
+extern int q_sort_algo;
+
+/**
+ * q_sort_threads - Number of threads q_sort() and q_merge() may use,
+ * default 1
+ *
+ * With more than one thread, the merge sorts cut the queue into segments,
+ * sort the segments concurrently and merge the sorted runs in a balanced
+ * tree whose merges at each level run concurrently as well. q_merge() merges
+ * the queues of the chain in the same kind of tree instead of a single heap.
+ * Short queues are still handled by the calling thread alone.
+ * Q_SORT_MULTIKEY and backends other than queue.c ignore this setting.
+ */
+extern int q_sort_threads;
+
+/**
+ * q_index - Index queues by position, default 0
+ *
+ * When nonzero, q_at() and q_remove_at() find positions through a skip list
+ * over the queue, built on first use, in O(log n) time instead of walking
+ * the queue. Insertions, as well as removals of single elements including
+ * q_delete_mid(), keep the index up to date in O(log n) time per element;
+ * other operations relinking the queue leave it to be rebuilt by the next
+ * positional access. Backends other than queue.c reach positions directly
+ * and ignore this setting.
+ */
+extern int q_index;
+
+/**
+ * q_cmp_count - Number of key comparisons done by q_sort() and q_merge()
+ *
+ * A key comparison is a string comparison, except in the partitioning steps
+ * of Q_SORT_MULTIKEY, which compare single bytes. The counter is never reset
+ * by the queue code; callers interested in the cost of a single operation
+ * clear it beforehand.
+ */
+extern unsigned long q_cmp_count;
+
+/**
+ * q_merge_cmp_count - Part of q_cmp_count spent merging sorted runs
+ *
+ * Counts the comparisons of q_merge() and of the merge steps of q_sort(),
+ * which galloping reduces when the runs barely overlap.
+ */
+extern unsigned long q_merge_cmp_count;
+
+/**
+ * q_gallop - Let merges gallop, default 1
+ *
+ * Once about seven nodes in a row come from the same run, a merge finds how
+ * many more follow with an exponential then binary search, and moves them
+ * as one block; the threshold adapts to how often this pays off. A run
+ * that precedes the other as a whole is moved after one comparison when its
+ * last node is at hand. Set to 0 to merge one node at a time, for instance to
+ * compare q_merge_cmp_count. Q_SORT_LIST_SORT is the list_sort() of list.h
+ * and always merges one node at a time.
+ */
+extern int q_gallop;
+
+/**
+ * q_element_is_compact() - Check whether the string of an element is stored
+ * inline
+ * @e: element to check
+ *
+ * Return: true if @e was allocated in compact layout
+ */
+static inline bool q_element_is_compact(const element_t *e)
+{
+    return e->value == e->inline_value;
+}
+
 /* Operations on queue */
 
 /**
  * q_new() - Create an empty queue whose next and prev pointer point to itself
  *
+ * The returned list head is embedded in a queue_head_t.
+ *
  * Return: NULL for allocation failed
  */
 struct list_head *q_new();
@@ -78,6 +244,33 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_bulk() - Insert a batch of elements in the head
+ * @head: header of queue
+ * @s: array of strings would be inserted
+ * @n: number of strings in @s
+ *
+ * Behaves like calling q_insert_head() on s[0], s[1], ..., s[n - 1] in turn,
+ * so s[n - 1] ends up at the head. The new elements are linked into a private
+ * chain first, which is then spliced into the queue in one operation.
+ *
+ * Return: the number of elements inserted. It is less than @n only if an
+ * allocation failed, in which case s[0] to s[ret - 1] have been inserted.
+ */
+int q_insert_head_bulk(struct list_head *head, char **s, int n);
+
+/**
+ * q_insert_tail_bulk() - Insert a batch of elements at the tail
+ * @head: header of queue
+ * @s: array of strings would be inserted
+ * @n: number of strings in @s
+ *
+ * Behaves like calling q_insert_tail() on s[0], s[1], ..., s[n - 1] in turn.
+ *
+ * Return: the number of elements inserted, see q_insert_head_bulk()
+ */
+int q_insert_tail_bulk(struct list_head *head, char **s, int n);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -108,6 +301,74 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_remove_head_n() - Remove a batch of elements from head of queue
+ * @head: header of queue
+ * @n: maximum number of elements to remove
+ * @list: list receiving the removed elements
+ *
+ * Removes the first min(@n, size) elements and appends them to @list in
+ * queue order, linked through their list members. No string is copied;
+ * read the values from the elements and release them with
+ * q_release_element() once done. The elements are detached from the queue
+ * in one operation rather than one by one.
+ *
+ * Return: the number of elements removed, 0 if queue is NULL or empty
+ */
+int q_remove_head_n(struct list_head *head, int n, struct list_head *list);
+
+/**
+ * q_remove_tail_n() - Remove a batch of elements from tail of queue
+ * @head: header of queue
+ * @n: maximum number of elements to remove
+ * @list: list receiving the removed elements
+ *
+ * Like q_remove_head_n() for the last min(@n, size) elements, which are
+ * also appended to @list in queue order, the old tail last.
+ *
+ * Return: the number of elements removed, 0 if queue is NULL or empty
+ */
+int q_remove_tail_n(struct list_head *head, int n, struct list_head *list);
+
+/**
+ * q_remove_at() - Remove the element at a given position of queue
+ * @head: header of queue
+ * @i: position of the element, counting from 0 at head of queue
+ * @sp: string would be inserted
+ * @bufsize: size of the string
+ *
+ * Like q_remove_head(), which is q_remove_at() at position 0.
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or @i is out of
+ * range
+ */
+element_t *q_remove_at(struct list_head *head,
+                       int i,
+                       char *sp,
+                       size_t bufsize);
+
+/**
+ * q_is_interned() - Check whether a string is interned
+ * @value: string of an element
+ *
+ * The check looks @value up in the table of interned strings, which is
+ * skipped while that table is empty.
+ *
+ * Return: true if @value is the interned copy of its string
+ */
+bool q_is_interned(const char *value);
+
+/**
+ * q_unintern() - Drop a reference to a string if it is interned
+ * @value: string of an element
+ *
+ * An interned string is freed once no element refers to it any more. This
+ * function is intended for internal use only.
+ *
+ * Return: true if @value was interned, false if it is left to the caller
+ */
+bool q_unintern(char *value);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
@@ -116,7 +377,8 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
+    if (!q_element_is_compact(e) && !q_unintern(e->value))
+        test_free(e->value);
     test_free(e);
 }
 
@@ -124,6 +386,8 @@ static inline void q_release_element(element_t *e)
  * q_size() - Get the size of the queue
  * @head: header of queue
  *
+ * The size is maintained by the queue operations, so this takes O(1) time.
+ *
  * Return: the number of elements in queue, zero if queue is NULL or empty
  */
 int q_size(struct list_head *head);
@@ -155,6 +419,20 @@ bool q_delete_mid(struct list_head *head);
  */
 bool q_delete_dup(struct list_head *head);
 
+/**
+ * q_delete_dup_unsorted() - Delete all nodes whose string appears more than
+ *                           once, in a queue of any order
+ * @head: header of queue
+ *
+ * Unlike q_delete_dup(), the queue need not be sorted first. Duplicates are
+ * found through a hash table, in expected O(n) time, and the remaining
+ * elements keep their relative order.
+ *
+ * Return: true for success, false if list is NULL or the hash table could
+ * not be allocated.
+ */
+bool q_delete_dup_unsorted(struct list_head *head);
+
 /**
  * q_swap() - Swap every two adjacent nodes
  * @head: header of queue
@@ -250,4 +528,123 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head, bool descend);
 
+/**
+ * q_splice() - Move every element of a queue to the head of another
+ * @head: header of queue receiving the elements
+ * @list: header of queue giving them, left empty
+ *
+ * The elements of @list keep their order and go before those of @head. No
+ * element is copied or allocated, so the queues of a chain can be rebalanced
+ * without going through q_remove_head() and q_insert_tail().
+ *
+ * Return: true for success, false if either queue is NULL, both are the same
+ * queue, or no room could be made for the elements
+ */
+bool q_splice(struct list_head *head, struct list_head *list);
+
+/**
+ * q_concat() - Move every element of a queue to the tail of another
+ * @head: header of queue receiving the elements
+ * @list: header of queue giving them, left empty
+ *
+ * Like q_splice(), except that the elements of @list go after those of
+ * @head.
+ *
+ * Return: true for success, false if either queue is NULL, both are the same
+ * queue, or no room could be made for the elements
+ */
+bool q_concat(struct list_head *head, struct list_head *list);
+
+/**
+ * q_split() - Move the elements after a position of queue to another queue
+ * @head: header of queue
+ * @k: number of elements staying in @head
+ * @list: header of queue receiving the others at its tail
+ *
+ * The elements keep their order. As with q_splice(), none is copied.
+ *
+ * Return: true for success, false if either queue is NULL, both are the same
+ * queue, @k is out of the range from 0 to the size of @head, or no room could
+ * be made for the elements
+ */
+bool q_split(struct list_head *head, int k, struct list_head *list);
+
+/* Traversal
+ *
+ * qtest walks queues through the following functions instead of following
+ * list links, so that it also drives the backends that do not link elements
+ * through element_t.list (see "make qtest-unrolled").
+ */
+
+/**
+ * q_iter_t - Position of an element within its queue
+ * @node: backend-specific location of the element
+ * @idx: backend-specific index of the element
+ */
+typedef struct {
+    void *node;
+    long idx;
+} q_iter_t;
+
+/**
+ * q_first() - Get the first element of queue
+ * @head: header of queue
+ * @it: iterator set to the position of the returned element
+ *
+ * Return: the element, NULL if queue is NULL or empty
+ */
+element_t *q_first(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_last() - Get the last element of queue
+ * @head: header of queue
+ * @it: iterator set to the position of the returned element
+ *
+ * Return: the element, NULL if queue is NULL or empty
+ */
+element_t *q_last(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_at() - Get the element at a given position of queue
+ * @head: header of queue
+ * @i: position of the element, counting from 0 at head of queue
+ * @it: iterator set to the position of the returned element
+ *
+ * q_next() and q_prev() continue from the returned element, so a range of
+ * the queue is visited in O(log n) time plus its length with q_index set.
+ *
+ * Return: the element, NULL if queue is NULL or @i is out of range
+ */
+element_t *q_at(struct list_head *head, int i, q_iter_t *it);
+
+/**
+ * q_next() - Advance an iterator to the following element
+ * @head: header of queue
+ * @it: iterator positioned by any of the traversal functions
+ *
+ * The queue must not be modified while it is being walked.
+ *
+ * Return: the element, NULL past the tail of queue. A NULL link also ends
+ * the walk, so that a corrupted queue is not followed into invalid memory.
+ */
+element_t *q_next(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_prev() - Move an iterator back to the preceding element
+ * @head: header of queue
+ * @it: iterator positioned by any of the traversal functions
+ *
+ * Return: the element, NULL before the head of queue, as for q_next()
+ */
+element_t *q_prev(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_for_each() - Iterate over the elements of queue from head to tail
+ * @e: element_t pointer set to each element in turn
+ * @head: header of queue
+ * @it: q_iter_t holding the position of @e
+ */
+#define q_for_each(e, head, it) \
+    for (e = q_first(head, &(it)); e; e = q_next(head, &(it)))
+
 #endif /* LAB0_QUEUE_H */
@@ -0,0 +1,759 @@
+/* Ring buffer backend of queue.h
+ *
+ * The queue is a power-of-two array of element pointers used as a circular
+ * buffer. Logical position i, counted from the head, lives in slot
+ * (front + i) & (cap - 1), or (front - i) & (cap - 1) once the queue has been
+ * reversed, so q_reverse() only moves front and flips the direction.
+ * element_t.list is left unused.
+ *
+ * Insertion at either end stores one pointer. A full buffer is replaced by
+ * one twice as large, which keeps insertion amortized O(1). The buffer never
+ * shrinks before q_free(), because removal must not fail, as an allocation
+ * could.
+ *
+ * q_merge() may not allocate either, yet may need a buffer larger than any
+ * queue has. Whenever a buffer grows, a spare buffer shared by all queues is
+ * grown as well to hold as many slots as all buffers together, and merging
+ * takes it over when needed.
+ *
+ * Operations touching every element first rotate the elements in place to
+ * the start of the buffer, in forward order, and then work on them as on a
+ * plain array with the helpers of element.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "element.h"
+#include "queue.h"
+
+/* Capacity of the first buffer of a queue */
+#define RING_MIN_CAP 8
+
+/* Accepted for the options of qtest. Sorting always uses multikey quicksort
+ * on the buffer, on the calling thread, and positions are reached directly.
+ */
+int q_sort_algo = Q_SORT_MULTIKEY;
+int q_sort_threads = 1;
+int q_index = 0;
+
+/* Spare buffer for q_merge(), with ring_spare_cap slots, a power of two. It
+ * holds at least ring_slots slots, the sum of the capacities of all queues,
+ * from any successful ring_reserve() until the next merge which takes it.
+ */
+static element_t **ring_spare;
+static unsigned int ring_spare_cap;
+static size_t ring_slots;
+static int ring_count;
+
+/**
+ * ring_t - Header of a queue
+ * @head: handle given out by q_new(), never linked to anything
+ * @buf: the slots, NULL until the first insertion
+ * @cap: number of slots, a power of two, or 0 without @buf
+ * @front: slot of the first element
+ * @reversed: whether the following elements are at decreasing slots
+ * @size: the number of elements in the queue
+ */
+typedef struct {
+    struct list_head head;
+    element_t **buf;
+    unsigned int cap;
+    unsigned int front;
+    bool reversed;
+    int size;
+} ring_t;
+
+static inline ring_t *ring_of(struct list_head *head)
+{
+    return list_entry(head, ring_t, head);
+}
+
+/* Index of the slot at logical position i, which may be -1 or q->size */
+static inline unsigned int ring_index(const ring_t *q, int i)
+{
+    unsigned int step = q->reversed ? -(unsigned int) i : (unsigned int) i;
+    return (q->front + step) & (q->cap - 1);
+}
+
+static inline element_t **ring_slot(const ring_t *q, int i)
+{
+    return &q->buf[ring_index(q, i)];
+}
+
+/* Move the elements of q to buf, which has cap slots, and return the old
+ * buffer for the caller to free
+ */
+static element_t **ring_move(ring_t *q, element_t **buf, unsigned int cap)
+{
+    element_t **old = q->buf;
+
+    for (int i = 0; i < q->size; i++)
+        buf[i] = *ring_slot(q, i);
+    q->buf = buf;
+    q->cap = cap;
+    q->front = 0;
+    q->reversed = false;
+    return old;
+}
+
+/* Make sure the spare buffer holds at least slots slots */
+static bool ring_spare_reserve(size_t slots)
+{
+    if (ring_spare_cap >= slots)
+        return true;
+
+    unsigned int cap = ring_spare_cap ? ring_spare_cap * 2 : RING_MIN_CAP;
+    while (cap < slots)
+        cap *= 2;
+    element_t **buf = malloc(cap * sizeof(element_t *));
+    if (!buf)
+        return false;
+    free(ring_spare);
+    ring_spare = buf;
+    ring_spare_cap = cap;
+    return true;
+}
+
+/* Make room for n more elements, doubling the buffer until they fit. The
+ * spare buffer is kept up to date first, even when no buffer grows, since a
+ * merge may have taken it over.
+ */
+static bool ring_reserve(ring_t *q, int n)
+{
+    unsigned int cap = q->cap;
+    if ((unsigned int) (q->size + n) > cap) {
+        cap = cap ? cap * 2 : RING_MIN_CAP;
+        while (cap < (unsigned int) (q->size + n))
+            cap *= 2;
+    }
+    if (!ring_spare_reserve(ring_slots - q->cap + cap))
+        return false;
+    if (cap == q->cap)
+        return true;
+
+    element_t **buf = malloc(cap * sizeof(element_t *));
+    if (!buf)
+        return false;
+    ring_slots += cap - q->cap;
+    free(ring_move(q, buf, cap));
+    return true;
+}
+
+static void reverse_array(element_t **a, size_t n)
+{
+    for (size_t i = 0, j = n; i + 1 < j; i++) {
+        element_t *tmp = a[i];
+        a[i] = a[--j];
+        a[j] = tmp;
+    }
+}
+
+/* Rotate the elements in place so that they occupy the first q->size slots
+ * in forward order, and return the buffer. This takes O(q->size) time
+ * whatever the capacity.
+ */
+static element_t **ring_linearize(ring_t *q)
+{
+    unsigned int n = q->size;
+    bool reversed = q->reversed;
+
+    if (!n) {
+        q->front = 0;
+        q->reversed = false;
+        return q->buf;
+    }
+
+    /* View a reversed queue as a forward one holding the elements in
+     * reverse order, to be reversed again at the end.
+     */
+    if (reversed)
+        q->front = ring_index(q, n - 1);
+
+    /* The elements form a run A from front up to the end of the buffer,
+     * possibly followed by a run B at its start. Place A right after B and
+     * swap the two runs with three reversals.
+     */
+    unsigned int a = q->cap - q->front < n ? q->cap - q->front : n;
+    unsigned int b = n - a;
+    if (b) {
+        memmove(q->buf + b, q->buf + q->front, a * sizeof(element_t *));
+        reverse_array(q->buf, n);
+        reverse_array(q->buf, a);
+        reverse_array(q->buf + a, b);
+    } else if (q->front) {
+        memmove(q->buf, q->buf + q->front, n * sizeof(element_t *));
+    }
+    if (reversed)
+        reverse_array(q->buf, n);
+
+    q->front = 0;
+    q->reversed = false;
+    return q->buf;
+}
+
+/* Create an empty queue */
+struct list_head *q_new()
+{
+    ring_t *q = malloc(sizeof(ring_t));
+    if (!q)
+        return NULL;
+
+    INIT_LIST_HEAD(&q->head);
+    q->buf = NULL;
+    q->cap = 0;
+    q->front = 0;
+    q->reversed = false;
+    q->size = 0;
+    ring_count++;
+    return &q->head;
+}
+
+/* Free all storage used by queue */
+void q_free(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    ring_t *q = ring_of(head);
+    for (int i = 0; i < q->size; i++)
+        q_release_element(*ring_slot(q, i));
+    ring_slots -= q->cap;
+    free(q->buf);
+    free(q);
+
+    /* The spare buffer goes with the last queue */
+    if (!--ring_count) {
+        free(ring_spare);
+        ring_spare = NULL;
+        ring_spare_cap = 0;
+    }
+}
+
+/* Allocate an element for s and store it at one end of the queue */
+static bool insert(struct list_head *head, char *s, bool at_head)
+{
+    if (!head || !s)
+        return false;
+
+    ring_t *q = ring_of(head);
+    element_t *e = element_new(s);
+    if (!e)
+        return false;
+    if (!ring_reserve(q, 1)) {
+        q_release_element(e);
+        return false;
+    }
+
+    if (at_head) {
+        q->front = ring_index(q, -1);
+        q->buf[q->front] = e;
+    } else {
+        *ring_slot(q, q->size) = e;
+    }
+    q->size++;
+    return true;
+}
+
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    return insert(head, s, true);
+}
+
+/* Insert an element at tail of queue */
+bool q_insert_tail(struct list_head *head, char *s)
+{
+    return insert(head, s, false);
+}
+
+/* Insert a batch of elements at head of queue */
+int q_insert_head_bulk(struct list_head *head, char **s, int n)
+{
+    if (!head || !s)
+        return 0;
+
+    int i;
+    for (i = 0; i < n && insert(head, s[i], true); i++)
+        ;
+    return i;
+}
+
+/* Insert a batch of elements at tail of queue */
+int q_insert_tail_bulk(struct list_head *head, char **s, int n)
+{
+    if (!head || !s)
+        return 0;
+
+    int i;
+    for (i = 0; i < n && insert(head, s[i], false); i++)
+        ;
+    return i;
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head || !ring_of(head)->size)
+        return NULL;
+
+    ring_t *q = ring_of(head);
+    element_t *e = q->buf[q->front];
+    q->front = ring_index(q, 1);
+    q->size--;
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
+
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head || !ring_of(head)->size)
+        return NULL;
+
+    ring_t *q = ring_of(head);
+    element_t *e = *ring_slot(q, --q->size);
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
+
+/* Link the elements at logical indexes [from, from + cnt) into list */
+static void ring_chain(ring_t *q, int from, int cnt, struct list_head *list)
+{
+    for (int i = 0; i < cnt; i++) {
+        element_t *e = *ring_slot(q, from + i);
+        list_add_tail(&e->list, list);
+    }
+}
+
+/* Remove a batch of elements from head of queue */
+int q_remove_head_n(struct list_head *head, int n, struct list_head *list)
+{
+    if (!head || !list || n <= 0)
+        return 0;
+
+    ring_t *q = ring_of(head);
+    int cnt = n < q->size ? n : q->size;
+    ring_chain(q, 0, cnt, list);
+    q->front = ring_index(q, cnt);
+    q->size -= cnt;
+    return cnt;
+}
+
+/* Remove a batch of elements from tail of queue */
+int q_remove_tail_n(struct list_head *head, int n, struct list_head *list)
+{
+    if (!head || !list || n <= 0)
+        return 0;
+
+    ring_t *q = ring_of(head);
+    int cnt = n < q->size ? n : q->size;
+    ring_chain(q, q->size - cnt, cnt, list);
+    q->size -= cnt;
+    return cnt;
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+
+    return ring_of(head)->size;
+}
+
+/* Take the element at logical position pos out of q, closing the gap from
+ * whichever side of it is shorter
+ */
+static element_t *ring_take(ring_t *q, int pos)
+{
+    element_t *e = *ring_slot(q, pos);
+    if (pos < q->size - 1 - pos) {
+        for (int i = pos; i > 0; i--)
+            *ring_slot(q, i) = *ring_slot(q, i - 1);
+        q->front = ring_index(q, 1);
+    } else {
+        for (int i = pos; i < q->size - 1; i++)
+            *ring_slot(q, i) = *ring_slot(q, i + 1);
+    }
+    q->size--;
+    return e;
+}
+
+/* Remove the element at a given position of queue */
+element_t *q_remove_at(struct list_head *head,
+                       int i,
+                       char *sp,
+                       size_t bufsize)
+{
+    if (!head || i < 0 || i >= ring_of(head)->size)
+        return NULL;
+
+    element_t *e = ring_take(ring_of(head), i);
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
+
+/* Delete the middle node in queue */
+bool q_delete_mid(struct list_head *head)
+{
+    // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
+    if (!head || !ring_of(head)->size)
+        return false;
+
+    ring_t *q = ring_of(head);
+    q_release_element(ring_take(q, q->size / 2));
+    return true;
+}
+
+/* Delete all nodes that have duplicate string */
+bool q_delete_dup(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
+    if (!head)
+        return false;
+
+    ring_t *q = ring_of(head);
+    q->size = element_dedup(ring_linearize(q), q->size);
+    return true;
+}
+
+/* Delete all nodes whose string appears more than once, in a queue of any
+ * order */
+bool q_delete_dup_unsorted(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    ring_t *q = ring_of(head);
+    if (q->size < 2)
+        return true;
+
+    size_t n = q->size;
+    if (!element_dedup_unsorted(ring_linearize(q), &n))
+        return false;
+    q->size = n;
+    return true;
+}
+
+/* Swap every two adjacent nodes */
+void q_swap(struct list_head *head)
+{
+    // https://leetcode.com/problems/swap-nodes-in-pairs/
+    q_reverseK(head, 2);
+}
+
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head || !ring_of(head)->size)
+        return;
+
+    ring_t *q = ring_of(head);
+    q->front = ring_index(q, q->size - 1);
+    q->reversed = !q->reversed;
+}
+
+/* Reverse the nodes of the list k at a time */
+void q_reverseK(struct list_head *head, int k)
+{
+    // https://leetcode.com/problems/reverse-nodes-in-k-group/
+    if (!head || k < 2)
+        return;
+
+    ring_t *q = ring_of(head);
+    for (int start = 0; q->size - start >= k; start += k) {
+        for (int i = start, j = start + k - 1; i < j; i++, j--) {
+            element_t **a = ring_slot(q, i), **b = ring_slot(q, j);
+            element_t *tmp = *a;
+            *a = *b;
+            *b = tmp;
+        }
+    }
+}
+
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
+{
+    if (!head || ring_of(head)->size < 2)
+        return;
+
+    ring_t *q = ring_of(head);
+    sort_ctx_t ctx = {.descend = descend, .cmp_count = 0};
+    element_sort(&ctx, ring_linearize(q), q->size);
+    sort_ctx_commit(&ctx);
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+int q_ascend(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-nodes-from-linked-list/
+    if (!head)
+        return 0;
+
+    ring_t *q = ring_of(head);
+    q->size = element_monotonic(ring_linearize(q), q->size, false);
+    return q->size;
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+int q_descend(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-nodes-from-linked-list/
+    if (!head)
+        return 0;
+
+    ring_t *q = ring_of(head);
+    q->size = element_monotonic(ring_linearize(q), q->size, true);
+    return q->size;
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+int q_merge(struct list_head *head, bool descend)
+{
+    // https://leetcode.com/problems/merge-k-sorted-lists/
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
+    if (!first->q)
+        return 0;
+
+    ring_t *dst = ring_of(first->q);
+    ring_t *big = dst;
+    int k = 0, n = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, head, chain) {
+        if (!ctx->q)
+            continue;
+        ring_t *q = ring_of(ctx->q);
+        if (q->size) {
+            k++;
+            n += q->size;
+        }
+        if (q->cap > big->cap)
+            big = q;
+    }
+    if (!n)
+        return 0;
+
+    /* The result needs a buffer of n slots. Use the largest buffer of the
+     * chain, by swapping it with the one of the first queue. If it is too
+     * small, it is exchanged for the spare buffer, which is large enough
+     * since the elements were inserted, and becomes the spare one in turn.
+     */
+    if (big->cap < (unsigned int) n) {
+        if (ring_spare_cap < (unsigned int) n)
+            return dst->size;
+        unsigned int cap = big->cap;
+        ring_slots += ring_spare_cap - cap;
+        ring_spare = ring_move(big, ring_spare, ring_spare_cap);
+        ring_spare_cap = cap;
+    }
+    if (big != dst) {
+        ring_t tmp = *dst;
+        *dst = *big;
+        *big = tmp;
+        INIT_LIST_HEAD(&dst->head);
+        INIT_LIST_HEAD(&big->head);
+    }
+
+    sort_ctx_t sort_ctx = {.descend = descend, .cmp_count = 0};
+    size_t *bounds = test_malloc_scratch((k + 1) * sizeof(size_t));
+    element_t **tmp = test_malloc_scratch(n * sizeof(element_t *));
+    if (bounds && tmp) {
+        /* Gather the queues into tmp as sorted runs, in the order of the
+         * chain for a stable merge. After the swap above, the elements of
+         * the first queue are those of big and the other way around.
+         */
+        int run = 0, len = 0;
+        bounds[0] = 0;
+        list_for_each_entry (ctx, head, chain) {
+            if (!ctx->q)
+                continue;
+            ring_t *q = ring_of(ctx->q);
+            if (q == dst)
+                q = big;
+            else if (q == big)
+                q = dst;
+            if (!q->size)
+                continue;
+
+            for (int i = 0; i < q->size; i++)
+                tmp[len++] = *ring_slot(q, i);
+            q->size = 0;
+            bounds[++run] = len;
+        }
+
+        dst->front = 0;
+        dst->reversed = false;
+        dst->size = n;
+        element_t **merged =
+            element_merge_runs(&sort_ctx, tmp, dst->buf, bounds, run);
+        if (merged != dst->buf)
+            memcpy(dst->buf, merged, n * sizeof(element_t *));
+    } else {
+        /* Append the other queues to the first one and sort */
+        element_t **a = ring_linearize(dst);
+        list_for_each_entry (ctx, head, chain) {
+            if (!ctx->q || ctx->q == first->q || !ring_of(ctx->q)->size)
+                continue;
+
+            ring_t *q = ring_of(ctx->q);
+            for (int i = 0; i < q->size; i++)
+                a[dst->size++] = *ring_slot(q, i);
+            q->size = 0;
+        }
+        element_sort(&sort_ctx, a, n);
+    }
+
+    test_free_scratch(tmp);
+    test_free_scratch(bounds);
+    sort_ctx_commit(&sort_ctx);
+    return dst->size;
+}
+
+/* Exchange the elements of two queues, leaving their handles in place */
+static void ring_swap(ring_t *a, ring_t *b)
+{
+    ring_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+    INIT_LIST_HEAD(&a->head);
+    INIT_LIST_HEAD(&b->head);
+}
+
+/* Move every element of src to one end of dst. The pointers of the shorter
+ * queue are copied into the buffer of the longer one, which dst takes over,
+ * so this takes O(min(dst->size, src->size)) time.
+ */
+static bool ring_join(ring_t *dst, ring_t *src, bool at_head)
+{
+    ring_t *big = src->size > dst->size ? src : dst;
+    ring_t *small = big == dst ? src : dst;
+    if (!ring_reserve(big, small->size))
+        return false;
+
+    /* Now src holds the shorter queue, going to the other end */
+    if (big == src) {
+        ring_swap(dst, src);
+        at_head = !at_head;
+    }
+    if (at_head) {
+        for (int i = src->size - 1; i >= 0; i--) {
+            dst->front = ring_index(dst, -1);
+            dst->buf[dst->front] = *ring_slot(src, i);
+        }
+    } else {
+        for (int i = 0; i < src->size; i++)
+            *ring_slot(dst, dst->size + i) = *ring_slot(src, i);
+    }
+    dst->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+/* Move every element of a queue to the head of another */
+bool q_splice(struct list_head *head, struct list_head *list)
+{
+    if (!head || !list || head == list)
+        return false;
+
+    return ring_join(ring_of(head), ring_of(list), true);
+}
+
+/* Move every element of a queue to the tail of another */
+bool q_concat(struct list_head *head, struct list_head *list)
+{
+    if (!head || !list || head == list)
+        return false;
+
+    return ring_join(ring_of(head), ring_of(list), false);
+}
+
+/* Move the elements of a queue after the first k to the tail of another */
+bool q_split(struct list_head *head, int k, struct list_head *list)
+{
+    if (!head || !list || head == list || k < 0 || k > ring_of(head)->size)
+        return false;
+
+    ring_t *q = ring_of(head), *dst = ring_of(list);
+    int n = q->size - k;
+
+    /* An empty destination can take over the buffer, leaving only the
+     * first k elements to copy back
+     */
+    if (!dst->size && k < n) {
+        if (!ring_reserve(dst, k))
+            return false;
+        ring_swap(q, dst);
+        for (int i = 0; i < k; i++)
+            *ring_slot(q, i) = *ring_slot(dst, i);
+        q->size = k;
+        dst->front = ring_index(dst, k);
+        dst->size = n;
+        return true;
+    }
+
+    if (!ring_reserve(dst, n))
+        return false;
+    for (int i = 0; i < n; i++)
+        *ring_slot(dst, dst->size + i) = *ring_slot(q, k + i);
+    dst->size += n;
+    q->size = k;
+    return true;
+}
+
+/* Get the first element of queue */
+element_t *q_first(struct list_head *head, q_iter_t *it)
+{
+    if (!head || !ring_of(head)->size)
+        return NULL;
+
+    it->node = NULL;
+    it->idx = 0;
+    return *ring_slot(ring_of(head), 0);
+}
+
+/* Get the last element of queue */
+element_t *q_last(struct list_head *head, q_iter_t *it)
+{
+    if (!head || !ring_of(head)->size)
+        return NULL;
+
+    it->node = NULL;
+    it->idx = ring_of(head)->size - 1;
+    return *ring_slot(ring_of(head), it->idx);
+}
+
+/* Get the element at a given position of queue */
+element_t *q_at(struct list_head *head, int i, q_iter_t *it)
+{
+    if (!head || i < 0 || i >= ring_of(head)->size)
+        return NULL;
+
+    it->node = NULL;
+    it->idx = i;
+    return *ring_slot(ring_of(head), i);
+}
+
+/* Advance an iterator to the following element */
+element_t *q_next(struct list_head *head, q_iter_t *it)
+{
+    if (it->idx + 1 >= ring_of(head)->size)
+        return NULL;
+
+    return *ring_slot(ring_of(head), ++it->idx);
+}
+
+/* Move an iterator back to the preceding element */
+element_t *q_prev(struct list_head *head, q_iter_t *it)
+{
+    if (it->idx <= 0)
+        return NULL;
+
+    return *ring_slot(ring_of(head), --it->idx);
+}
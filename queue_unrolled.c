@@ -0,0 +1,964 @@
+/* Unrolled linked-list backend of queue.h
+ *
+ * Elements are not linked one by one. Their pointers are stored in chunks of
+ * CHUNK_SLOTS slots, and only the chunks are linked, so a walk over the
+ * queue touches a chunk header once per CHUNK_SLOTS elements instead of a
+ * list node per element. element_t.list is left unused.
+ *
+ * Chunks fill from either end: a chunk added at the head is filled from its
+ * last slot downwards, one added at the tail from its first slot upwards.
+ * Insertion and removal at both ends are therefore O(1) without moving any
+ * pointer. An operation leaving a chunk empty takes it off the list, so the
+ * queue never holds empty chunks.
+ *
+ * Operations touching every element, such as sorting and the deletions of
+ * duplicates, either gather the pointers into a scratch array and write
+ * them back, or pack the remaining elements in place through a cursor.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "element.h"
+#include "queue.h"
+
+/* Number of element pointers per chunk */
+#define CHUNK_SLOTS 32
+
+/* Accepted for the options of qtest. Sorting always uses multikey quicksort
+ * on the gathered pointers, on the calling thread, and positions are found
+ * by skipping whole chunks.
+ */
+int q_sort_algo = Q_SORT_MULTIKEY;
+int q_sort_threads = 1;
+int q_index = 0;
+
+/**
+ * chunk_t - Block of element pointers
+ * @link: node in the list of chunks of the queue
+ * @lo: first used slot
+ * @hi: one past the last used slot
+ * @slots: element pointers, in queue order within [@lo, @hi)
+ */
+typedef struct {
+    struct list_head link;
+    int lo, hi;
+    element_t *slots[CHUNK_SLOTS];
+} chunk_t;
+
+/**
+ * unrolled_t - Header of a queue
+ * @head: handle given out by q_new(), never linked to anything
+ * @chunks: list of chunks, in queue order
+ * @spare: an emptied chunk kept for reuse, or NULL
+ * @size: the number of elements in the queue
+ *
+ * @spare saves a queue that repeatedly crosses a chunk boundary, as a FIFO
+ * does once per CHUNK_SLOTS operations, from allocating and freeing a chunk
+ * each time.
+ */
+typedef struct {
+    struct list_head head;
+    struct list_head chunks;
+    chunk_t *spare;
+    int size;
+} unrolled_t;
+
+/**
+ * pos_t - Position of a slot
+ * @c: chunk holding the slot
+ * @i: index of the slot in @c
+ */
+typedef struct {
+    chunk_t *c;
+    int i;
+} pos_t;
+
+static inline unrolled_t *queue_of(struct list_head *head)
+{
+    return list_entry(head, unrolled_t, head);
+}
+
+static inline chunk_t *chunk_of(struct list_head *link)
+{
+    return list_entry(link, chunk_t, link);
+}
+
+/* Get an empty chunk whose slots will be used from lo onwards or downwards */
+static chunk_t *chunk_get(unrolled_t *q, int lo)
+{
+    chunk_t *c = q->spare;
+
+    if (c)
+        q->spare = NULL;
+    else if (!(c = malloc(sizeof(chunk_t))))
+        return NULL;
+    c->lo = c->hi = lo;
+    return c;
+}
+
+/* Unlink an emptied chunk, keeping it as the spare one if there is none */
+static void chunk_put(unrolled_t *q, chunk_t *c)
+{
+    list_del(&c->link);
+    if (!q->spare)
+        q->spare = c;
+    else
+        free(c);
+}
+
+/* Advance p to the following slot. Return false past the last one. */
+static inline bool pos_next(unrolled_t *q, pos_t *p)
+{
+    if (++p->i < p->c->hi)
+        return true;
+    if (p->c->link.next == &q->chunks)
+        return false;
+    p->c = chunk_of(p->c->link.next);
+    p->i = p->c->lo;
+    return true;
+}
+
+/* Move p back to the preceding slot. Return false before the first one. */
+static inline bool pos_prev(unrolled_t *q, pos_t *p)
+{
+    if (--p->i >= p->c->lo)
+        return true;
+    if (p->c->link.prev == &q->chunks)
+        return false;
+    p->c = chunk_of(p->c->link.prev);
+    p->i = p->c->hi - 1;
+    return true;
+}
+
+static inline element_t **pos_slot(pos_t p)
+{
+    return &p.c->slots[p.i];
+}
+
+/* Position of the first element. The queue must not be empty. */
+static inline pos_t pos_first(unrolled_t *q)
+{
+    chunk_t *c = chunk_of(q->chunks.next);
+    return (pos_t){.c = c, .i = c->lo};
+}
+
+/* Position of the last element. The queue must not be empty. */
+static inline pos_t pos_last(unrolled_t *q)
+{
+    chunk_t *c = chunk_of(q->chunks.prev);
+    return (pos_t){.c = c, .i = c->hi - 1};
+}
+
+/* Get the position of the element at index idx, which must be less than
+ * q->size, walking the chunks from the nearer end of q
+ */
+static pos_t pos_at(unrolled_t *q, int idx)
+{
+    chunk_t *c;
+
+    if (idx < q->size / 2) {
+        list_for_each_entry (c, &q->chunks, link) {
+            if (idx < c->hi - c->lo)
+                break;
+            idx -= c->hi - c->lo;
+        }
+        return (pos_t){.c = c, .i = c->lo + idx};
+    }
+
+    idx = q->size - 1 - idx;
+    for (c = chunk_of(q->chunks.prev);; c = chunk_of(c->link.prev)) {
+        if (idx < c->hi - c->lo)
+            break;
+        idx -= c->hi - c->lo;
+    }
+    return (pos_t){.c = c, .i = c->hi - 1 - idx};
+}
+
+/* Create an empty queue */
+struct list_head *q_new()
+{
+    unrolled_t *q = malloc(sizeof(unrolled_t));
+    if (!q)
+        return NULL;
+
+    INIT_LIST_HEAD(&q->head);
+    INIT_LIST_HEAD(&q->chunks);
+    q->spare = NULL;
+    q->size = 0;
+    return &q->head;
+}
+
+/* Free all storage used by queue */
+void q_free(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    unrolled_t *q = queue_of(head);
+    chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &q->chunks, link) {
+        for (int i = c->lo; i < c->hi; i++)
+            q_release_element(c->slots[i]);
+        free(c);
+    }
+    free(q->spare);
+    free(q);
+}
+
+/* Store e at one end of q, adding a chunk if the one there is full */
+static bool push(unrolled_t *q, element_t *e, bool at_head)
+{
+    chunk_t *c = NULL;
+
+    if (at_head) {
+        if (!list_empty(&q->chunks))
+            c = chunk_of(q->chunks.next);
+        if (!c || !c->lo) {
+            if (!(c = chunk_get(q, CHUNK_SLOTS)))
+                return false;
+            list_add(&c->link, &q->chunks);
+        }
+        c->slots[--c->lo] = e;
+    } else {
+        if (!list_empty(&q->chunks))
+            c = chunk_of(q->chunks.prev);
+        if (!c || c->hi == CHUNK_SLOTS) {
+            if (!(c = chunk_get(q, 0)))
+                return false;
+            list_add_tail(&c->link, &q->chunks);
+        }
+        c->slots[c->hi++] = e;
+    }
+    q->size++;
+    return true;
+}
+
+/* Allocate an element for s and store it at one end of q */
+static bool insert(struct list_head *head, char *s, bool at_head)
+{
+    if (!head || !s)
+        return false;
+
+    element_t *e = element_new(s);
+    if (!e)
+        return false;
+    if (!push(queue_of(head), e, at_head)) {
+        q_release_element(e);
+        return false;
+    }
+    return true;
+}
+
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    return insert(head, s, true);
+}
+
+/* Insert an element at tail of queue */
+bool q_insert_tail(struct list_head *head, char *s)
+{
+    return insert(head, s, false);
+}
+
+/* Insert a batch of elements at head of queue */
+int q_insert_head_bulk(struct list_head *head, char **s, int n)
+{
+    if (!head || !s)
+        return 0;
+
+    int i;
+    for (i = 0; i < n && insert(head, s[i], true); i++)
+        ;
+    return i;
+}
+
+/* Insert a batch of elements at tail of queue */
+int q_insert_tail_bulk(struct list_head *head, char **s, int n)
+{
+    if (!head || !s)
+        return 0;
+
+    int i;
+    for (i = 0; i < n && insert(head, s[i], false); i++)
+        ;
+    return i;
+}
+
+/* Take the element at one end of q, which must not be empty */
+static element_t *pop(unrolled_t *q, bool at_head)
+{
+    element_t *e;
+    chunk_t *c;
+
+    if (at_head) {
+        c = chunk_of(q->chunks.next);
+        e = c->slots[c->lo++];
+    } else {
+        c = chunk_of(q->chunks.prev);
+        e = c->slots[--c->hi];
+    }
+    if (c->lo == c->hi)
+        chunk_put(q, c);
+    q->size--;
+    return e;
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head || !queue_of(head)->size)
+        return NULL;
+
+    element_t *e = pop(queue_of(head), true);
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
+
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head || !queue_of(head)->size)
+        return NULL;
+
+    element_t *e = pop(queue_of(head), false);
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
+
+/* Remove a batch of elements from head of queue */
+int q_remove_head_n(struct list_head *head, int n, struct list_head *list)
+{
+    if (!head || !list)
+        return 0;
+
+    unrolled_t *q = queue_of(head);
+    int cnt;
+    for (cnt = 0; cnt < n && q->size; cnt++) {
+        element_t *e = pop(q, true);
+        list_add_tail(&e->list, list);
+    }
+    return cnt;
+}
+
+/* Remove a batch of elements from tail of queue */
+int q_remove_tail_n(struct list_head *head, int n, struct list_head *list)
+{
+    if (!head || !list)
+        return 0;
+
+    /* Popped from the tail backwards, so chain them in reverse */
+    unrolled_t *q = queue_of(head);
+    LIST_HEAD(chain);
+    int cnt;
+    for (cnt = 0; cnt < n && q->size; cnt++) {
+        element_t *e = pop(q, false);
+        list_add(&e->list, &chain);
+    }
+    list_splice_tail(&chain, list);
+    return cnt;
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+
+    return queue_of(head)->size;
+}
+
+/* Take the element at p out of q, closing the gap in its chunk from
+ * whichever side of it is shorter
+ */
+static element_t *take(unrolled_t *q, pos_t p)
+{
+    chunk_t *c = p.c;
+    int i = p.i;
+    element_t *e = c->slots[i];
+    if (i - c->lo < c->hi - 1 - i) {
+        memmove(&c->slots[c->lo + 1], &c->slots[c->lo],
+                (i - c->lo) * sizeof(element_t *));
+        c->lo++;
+    } else {
+        memmove(&c->slots[i], &c->slots[i + 1],
+                (c->hi - 1 - i) * sizeof(element_t *));
+        c->hi--;
+    }
+    if (c->lo == c->hi)
+        chunk_put(q, c);
+    q->size--;
+    return e;
+}
+
+/* Remove the element at a given position of queue */
+element_t *q_remove_at(struct list_head *head,
+                       int i,
+                       char *sp,
+                       size_t bufsize)
+{
+    if (!head || i < 0 || i >= queue_of(head)->size)
+        return NULL;
+
+    unrolled_t *q = queue_of(head);
+    element_t *e = take(q, pos_at(q, i));
+    element_copy_value(e, sp, bufsize);
+    return e;
+}
+
+/* Delete the middle node in queue */
+bool q_delete_mid(struct list_head *head)
+{
+    // https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
+    if (!head || !queue_of(head)->size)
+        return false;
+
+    unrolled_t *q = queue_of(head);
+    q_release_element(take(q, pos_at(q, q->size / 2)));
+    return true;
+}
+
+/**
+ * packer_t - Cursor writing back the elements kept by a filter
+ * @q: queue being filtered
+ * @c: chunk being written
+ * @i: next slot to write in @c
+ * @start: first slot written in the first chunk, which is its original lo
+ * @n: number of elements written
+ *
+ * The filters read the queue from head to tail and pass the elements they
+ * keep to pack_push(), which packs them towards the head. Writing never
+ * overtakes reading, because every chunk is written from its first slot
+ * while it was read from its lo, and a chunk is only entered once all the
+ * chunks before it are full. pack_finish() then fixes up the chunk bounds
+ * and drops the chunks left unused.
+ */
+typedef struct {
+    unrolled_t *q;
+    chunk_t *c;
+    int i, start, n;
+} packer_t;
+
+static void pack_init(packer_t *p, unrolled_t *q)
+{
+    p->q = q;
+    p->c = chunk_of(q->chunks.next);
+    p->i = p->start = p->c->lo;
+    p->n = 0;
+}
+
+static inline int pack_chunk_start(const packer_t *p, const chunk_t *c)
+{
+    return &c->link == p->q->chunks.next ? p->start : 0;
+}
+
+static void pack_push(packer_t *p, element_t *e)
+{
+    if (p->i == CHUNK_SLOTS) {
+        p->c = chunk_of(p->c->link.next);
+        p->i = 0;
+    }
+    p->c->slots[p->i++] = e;
+    p->n++;
+}
+
+/* Take back the last element written. There must be one. */
+static element_t *pack_pop(packer_t *p)
+{
+    if (p->i == pack_chunk_start(p, p->c)) {
+        p->c = chunk_of(p->c->link.prev);
+        p->i = CHUNK_SLOTS;
+    }
+    p->n--;
+    return p->c->slots[--p->i];
+}
+
+/* Get the last element written. There must be one. */
+static element_t *pack_top(const packer_t *p)
+{
+    if (p->i == pack_chunk_start(p, p->c))
+        return chunk_of(p->c->link.prev)->slots[CHUNK_SLOTS - 1];
+    return p->c->slots[p->i - 1];
+}
+
+static void pack_finish(packer_t *p)
+{
+    unrolled_t *q = p->q;
+    chunk_t *c, *safe;
+    bool used = p->n > 0;
+
+    list_for_each_entry_safe (c, safe, &q->chunks, link) {
+        if (!used) {
+            chunk_put(q, c);
+            continue;
+        }
+        c->lo = pack_chunk_start(p, c);
+        c->hi = c == p->c ? p->i : CHUNK_SLOTS;
+        if (c == p->c)
+            used = false;
+        if (c->lo == c->hi)
+            chunk_put(q, c);
+    }
+    q->size = p->n;
+}
+
+/* Delete all nodes that have duplicate string */
+bool q_delete_dup(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
+    if (!head)
+        return false;
+
+    unrolled_t *q = queue_of(head);
+    if (!q->size)
+        return true;
+
+    /* run is the last element kept, and dup whether a later element had
+     * the same string, in which case run goes as well.
+     */
+    packer_t p;
+    element_t *run = NULL;
+    bool dup = false;
+    chunk_t *c;
+    pack_init(&p, q);
+    list_for_each_entry (c, &q->chunks, link) {
+        for (int i = c->lo, hi = c->hi; i < hi; i++) {
+            element_t *e = c->slots[i];
+            if (run && !value_cmp(run, e)) {
+                q_release_element(e);
+                dup = true;
+                continue;
+            }
+            if (dup)
+                q_release_element(pack_pop(&p));
+            pack_push(&p, e);
+            run = e;
+            dup = false;
+        }
+    }
+    if (dup)
+        q_release_element(pack_pop(&p));
+    pack_finish(&p);
+    return true;
+}
+
+/* Delete all nodes whose string appears more than once, in a queue of any
+ * order */
+bool q_delete_dup_unsorted(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    unrolled_t *q = queue_of(head);
+    if (q->size < 2)
+        return true;
+
+    size_t cap;
+    dedup_slot_t *table = dedup_table_new(q->size, &cap);
+    if (!table)
+        return false;
+
+    /* Drop later occurrences in a first pass, first ones in a second pass */
+    packer_t p;
+    chunk_t *c;
+    pack_init(&p, q);
+    list_for_each_entry (c, &q->chunks, link) {
+        for (int i = c->lo, hi = c->hi; i < hi; i++) {
+            element_t *e = c->slots[i];
+            dedup_slot_t *slot = dedup_lookup(table, cap, e);
+            if (slot->e == e) {
+                pack_push(&p, e);
+                continue;
+            }
+            slot->dup = 1;
+            q_release_element(e);
+        }
+    }
+    pack_finish(&p);
+
+    if (q->size) {
+        pack_init(&p, q);
+        list_for_each_entry (c, &q->chunks, link) {
+            for (int i = c->lo, hi = c->hi; i < hi; i++) {
+                element_t *e = c->slots[i];
+                if (dedup_lookup(table, cap, e)->dup)
+                    q_release_element(e);
+                else
+                    pack_push(&p, e);
+            }
+        }
+        pack_finish(&p);
+    }
+
+    test_free_scratch(table);
+    return true;
+}
+
+/* Swap every two adjacent nodes */
+void q_swap(struct list_head *head)
+{
+    // https://leetcode.com/problems/swap-nodes-in-pairs/
+    q_reverseK(head, 2);
+}
+
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    /* Reverse the order of the chunks, then the slots within each chunk */
+    unrolled_t *q = queue_of(head);
+    struct list_head *node = &q->chunks;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != &q->chunks);
+
+    chunk_t *c;
+    list_for_each_entry (c, &q->chunks, link) {
+        for (int i = c->lo, j = c->hi - 1; i < j; i++, j--) {
+            element_t *tmp = c->slots[i];
+            c->slots[i] = c->slots[j];
+            c->slots[j] = tmp;
+        }
+    }
+}
+
+/* Reverse the nodes of the list k at a time */
+void q_reverseK(struct list_head *head, int k)
+{
+    // https://leetcode.com/problems/reverse-nodes-in-k-group/
+    if (!head || k < 2)
+        return;
+
+    unrolled_t *q = queue_of(head);
+    pos_t start = {0};
+    bool more = q->size >= k;
+    if (more)
+        start = pos_first(q);
+
+    for (int left = q->size; more && left >= k; left -= k) {
+        pos_t end = start;
+        for (int i = 1; i < k; i++)
+            pos_next(q, &end);
+
+        pos_t next = end;
+        more = pos_next(q, &next);
+
+        pos_t a = start, b = end;
+        for (int i = 0; i < k / 2; i++) {
+            element_t *tmp = *pos_slot(a);
+            *pos_slot(a) = *pos_slot(b);
+            *pos_slot(b) = tmp;
+            pos_next(q, &a);
+            pos_prev(q, &b);
+        }
+        start = next;
+    }
+}
+
+/* Copy the elements of q, in order, to a */
+static void gather(unrolled_t *q, element_t **a)
+{
+    chunk_t *c;
+    list_for_each_entry (c, &q->chunks, link) {
+        memcpy(a, &c->slots[c->lo], (c->hi - c->lo) * sizeof(element_t *));
+        a += c->hi - c->lo;
+    }
+}
+
+/* Store a[0..q->size - 1] into the slots of q, in order, keeping the shape
+ * of the chunks
+ */
+static void scatter(unrolled_t *q, element_t **a)
+{
+    chunk_t *c;
+    list_for_each_entry (c, &q->chunks, link) {
+        memcpy(&c->slots[c->lo], a, (c->hi - c->lo) * sizeof(element_t *));
+        a += c->hi - c->lo;
+    }
+}
+
+/* Insertion sort in place, for when no scratch space is available. Each
+ * element is carried forward from the first element greater than it,
+ * shifting the rest of the sorted prefix one slot to the right.
+ */
+static void slow_sort(sort_ctx_t *ctx, unrolled_t *q)
+{
+    pos_t r = pos_first(q);
+
+    do {
+        element_t *x = *pos_slot(r);
+        bool carry = false;
+        for (pos_t w = pos_first(q); w.c != r.c || w.i != r.i;
+             pos_next(q, &w)) {
+            element_t **slot = pos_slot(w);
+            if (carry || element_cmp(ctx, *slot, x) > 0) {
+                element_t *tmp = *slot;
+                *slot = x;
+                x = tmp;
+                carry = true;
+            }
+        }
+        *pos_slot(r) = x;
+    } while (pos_next(q, &r));
+}
+
+/* Sort q by gathering its pointers into a scratch array */
+static void sort_chunks(sort_ctx_t *ctx, unrolled_t *q)
+{
+    element_t **a = test_malloc_scratch(q->size * sizeof(element_t *));
+    if (!a) {
+        slow_sort(ctx, q);
+        return;
+    }
+
+    gather(q, a);
+    element_sort(ctx, a, q->size);
+    scatter(q, a);
+    test_free_scratch(a);
+}
+
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
+{
+    if (!head || queue_of(head)->size < 2)
+        return;
+
+    sort_ctx_t ctx = {.descend = descend, .cmp_count = 0};
+    sort_chunks(&ctx, queue_of(head));
+    sort_ctx_commit(&ctx);
+}
+
+/* Keep the elements that no later element compares less than, or greater
+ * than if descend. The kept elements form a stack: each element read evicts
+ * the kept ones it shows to break the rule.
+ */
+static int q_monotonic(struct list_head *head, bool descend)
+{
+    if (!head || !queue_of(head)->size)
+        return 0;
+
+    unrolled_t *q = queue_of(head);
+    packer_t p;
+    chunk_t *c;
+    pack_init(&p, q);
+    list_for_each_entry (c, &q->chunks, link) {
+        for (int i = c->lo, hi = c->hi; i < hi; i++) {
+            element_t *e = c->slots[i];
+            while (p.n) {
+                int cmp = value_cmp(pack_top(&p), e);
+                if (descend ? cmp >= 0 : cmp <= 0)
+                    break;
+                q_release_element(pack_pop(&p));
+            }
+            pack_push(&p, e);
+        }
+    }
+    pack_finish(&p);
+    return q->size;
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+int q_ascend(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-nodes-from-linked-list/
+    return q_monotonic(head, false);
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+int q_descend(struct list_head *head)
+{
+    // https://leetcode.com/problems/remove-nodes-from-linked-list/
+    return q_monotonic(head, true);
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+int q_merge(struct list_head *head, bool descend)
+{
+    // https://leetcode.com/problems/merge-k-sorted-lists/
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *first = list_first_entry(head, queue_contex_t, chain);
+    if (!first->q)
+        return 0;
+
+    unrolled_t *dst = queue_of(first->q);
+    int k = 0, n = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, head, chain) {
+        if (ctx->q && queue_of(ctx->q)->size) {
+            k++;
+            n += queue_of(ctx->q)->size;
+        }
+    }
+
+    /* Gather every queue as a run of one array and merge the runs there.
+     * The chunks of the other queues are then moved to the first one, whose
+     * slots receive the result.
+     */
+    sort_ctx_t sort_ctx = {.descend = descend, .cmp_count = 0};
+    element_t **a = test_malloc_scratch(n * sizeof(element_t *));
+    element_t **tmp = test_malloc_scratch(n * sizeof(element_t *));
+    size_t *bounds = test_malloc_scratch((k + 1) * sizeof(size_t));
+    bool gathered = a && tmp && bounds;
+
+    int run = 0;
+    if (gathered)
+        bounds[0] = 0;
+    list_for_each_entry (ctx, head, chain) {
+        if (!ctx->q || !queue_of(ctx->q)->size)
+            continue;
+
+        unrolled_t *q = queue_of(ctx->q);
+        if (gathered) {
+            gather(q, a + bounds[run]);
+            bounds[run + 1] = bounds[run] + q->size;
+            run++;
+        }
+        if (q != dst) {
+            list_splice_tail_init(&q->chunks, &dst->chunks);
+            dst->size += q->size;
+            q->size = 0;
+        }
+    }
+
+    if (gathered)
+        scatter(dst, element_merge_runs(&sort_ctx, a, tmp, bounds, k));
+    else if (dst->size > 1)
+        sort_chunks(&sort_ctx, dst);
+
+    test_free_scratch(a);
+    test_free_scratch(tmp);
+    test_free_scratch(bounds);
+    sort_ctx_commit(&sort_ctx);
+    return dst->size;
+}
+
+/* Move every element of a queue to the head of another */
+bool q_splice(struct list_head *head, struct list_head *list)
+{
+    if (!head || !list || head == list)
+        return false;
+
+    unrolled_t *q = queue_of(head), *src = queue_of(list);
+    list_splice_init(&src->chunks, &q->chunks);
+    q->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+/* Move every element of a queue to the tail of another */
+bool q_concat(struct list_head *head, struct list_head *list)
+{
+    if (!head || !list || head == list)
+        return false;
+
+    unrolled_t *q = queue_of(head), *src = queue_of(list);
+    list_splice_tail_init(&src->chunks, &q->chunks);
+    q->size += src->size;
+    src->size = 0;
+    return true;
+}
+
+/* Move the elements of a queue after the first k to the tail of another */
+bool q_split(struct list_head *head, int k, struct list_head *list)
+{
+    if (!head || !list || head == list || k < 0 || k > queue_of(head)->size)
+        return false;
+
+    unrolled_t *q = queue_of(head), *dst = queue_of(list);
+    if (k == q->size)
+        return true;
+
+    /* Whole chunks move as they are. A chunk the cut falls into gives the
+     * slots from the cut onwards to a new chunk following it.
+     */
+    pos_t p = pos_at(q, k);
+    chunk_t *first = p.c;
+    if (p.i > p.c->lo) {
+        if (!(first = chunk_get(dst, 0)))
+            return false;
+        first->hi = p.c->hi - p.i;
+        memcpy(first->slots, &p.c->slots[p.i],
+               first->hi * sizeof(element_t *));
+        p.c->hi = p.i;
+        list_add(&first->link, &p.c->link);
+    }
+
+    LIST_HEAD(front);
+    list_cut_position(&front, &q->chunks, first->link.prev);
+    list_splice_tail_init(&q->chunks, &dst->chunks);
+    list_splice(&front, &q->chunks);
+    dst->size += q->size - k;
+    q->size = k;
+    return true;
+}
+
+/* Get the first element of queue */
+element_t *q_first(struct list_head *head, q_iter_t *it)
+{
+    if (!head || !queue_of(head)->size)
+        return NULL;
+
+    pos_t p = pos_first(queue_of(head));
+    it->node = p.c;
+    it->idx = p.i;
+    return *pos_slot(p);
+}
+
+/* Get the last element of queue */
+element_t *q_last(struct list_head *head, q_iter_t *it)
+{
+    if (!head || !queue_of(head)->size)
+        return NULL;
+
+    pos_t p = pos_last(queue_of(head));
+    it->node = p.c;
+    it->idx = p.i;
+    return *pos_slot(p);
+}
+
+/* Get the element at a given position of queue */
+element_t *q_at(struct list_head *head, int i, q_iter_t *it)
+{
+    if (!head || i < 0 || i >= queue_of(head)->size)
+        return NULL;
+
+    pos_t p = pos_at(queue_of(head), i);
+    it->node = p.c;
+    it->idx = p.i;
+    return *pos_slot(p);
+}
+
+/* Advance an iterator to the following element */
+element_t *q_next(struct list_head *head, q_iter_t *it)
+{
+    pos_t p = {.c = it->node, .i = it->idx};
+    if (!pos_next(queue_of(head), &p))
+        return NULL;
+
+    it->node = p.c;
+    it->idx = p.i;
+    return *pos_slot(p);
+}
+
+/* Move an iterator back to the preceding element */
+element_t *q_prev(struct list_head *head, q_iter_t *it)
+{
+    pos_t p = {.c = it->node, .i = it->idx};
+    if (!pos_prev(queue_of(head), &p))
+        return NULL;
+
+    it->node = p.c;
+    it->idx = p.i;
+    return *pos_slot(p);
+}
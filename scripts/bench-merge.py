@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+
+# Print the trace of the merge benchmark, which is too long to keep as a file
+# in traces/: each queue is built by three commands of its own.
+
+import argparse
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-q', '--queues', type=int, default=1000,
+                        help='number of queues to merge')
+    parser.add_argument('-n', '--size', type=int, default=100,
+                        help='number of random strings in each queue')
+    args = parser.parse_args()
+
+    print('# Merge {:,} sorted queues of {} random strings each'.format(
+        args.queues, args.size))
+    print('option fail 0')
+    print('option malloc 0')
+    print('option time 60')
+    for _ in range(args.queues):
+        print('new')
+        print('ih RAND {}'.format(args.size))
+        print('sort')
+    print('time merge')
+    print('size')
+    print('free')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,220 @@
+/* Order-statistic skip list over a circular doubly-linked list
+ *
+ * The structure is the indexable skip list of W. Pugh, "A Skip List
+ * Cookbook" (1990). Position 0 is the header of the list and the nodes
+ * follow from position 1. A tower of height h over a node has links on
+ * levels 1 to h, each pointing to the next tower at least as high and
+ * recording the difference of their positions as its width. Level 0 is the
+ * list itself, whose links all have width 1, and needs no storage. The
+ * header has a tower of every height, and the last link on each level
+ * points to NULL with the width reaching one past the last node.
+ *
+ * A node gets a tower with probability 1/4, and a tower one more level with
+ * probability 1/4 again, so the expected overhead is a third of a link per
+ * node. Finding a position visits an expected four towers per level before
+ * walking at most a few nodes of the list.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "skiplist.h"
+
+/* Number of levels above the list, enough for 4^16 nodes */
+#define SKIP_LEVELS 16
+
+typedef struct skip_tower skip_tower_t;
+
+typedef struct {
+    skip_tower_t *next;
+    int width;
+} skip_link_t;
+
+/* The links of levels 1 to h of a tower of height h are link[0] to
+ * link[h - 1]
+ */
+struct skip_tower {
+    struct list_head *node;
+    skip_link_t link[];
+};
+
+struct skiplist {
+    skip_link_t head[SKIP_LEVELS];
+};
+
+/* Draw the height of a new tower, 0 for none, from a xorshift generator.
+ * Its fixed seed keeps the shape of the index reproducible from run to run.
+ */
+static int skip_height(void)
+{
+    static uint32_t state = 2463534242;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    int h = 0;
+    for (uint32_t r = state; !(r & 3) && h < SKIP_LEVELS; r >>= 2)
+        h++;
+    return h;
+}
+
+static skip_tower_t *tower_new(struct list_head *node, int height)
+{
+    skip_tower_t *t =
+        malloc(sizeof(skip_tower_t) + height * sizeof(skip_link_t));
+    if (!t)
+        return NULL;
+
+    t->node = node;
+    for (int l = 0; l < height; l++)
+        t->link[l].next = NULL;
+    return t;
+}
+
+/* Find the node at position pos. On each level l, store in update[l] the
+ * links of the last tower at or before pos, and in upos[l] its position,
+ * when update is not NULL.
+ */
+static struct list_head *skip_find(skiplist_t *s,
+                                   struct list_head *head,
+                                   int pos,
+                                   skip_link_t **update,
+                                   int *upos)
+{
+    skip_link_t *x = s->head;
+    struct list_head *node = head;
+    int at = 0;
+
+    for (int l = SKIP_LEVELS - 1; l >= 0; l--) {
+        while (x[l].next && at + x[l].width <= pos) {
+            at += x[l].width;
+            node = x[l].next->node;
+            x = x[l].next->link;
+        }
+        if (update) {
+            update[l] = x;
+            upos[l] = at;
+        }
+    }
+
+    while (at++ < pos)
+        node = node->next;
+    return node;
+}
+
+skiplist_t *skiplist_new(struct list_head *head, int size)
+{
+    skiplist_t *s = malloc(sizeof(skiplist_t));
+    if (!s)
+        return NULL;
+
+    skip_link_t *last[SKIP_LEVELS];
+    int lastpos[SKIP_LEVELS];
+    for (int l = 0; l < SKIP_LEVELS; l++) {
+        s->head[l].next = NULL;
+        last[l] = s->head;
+        lastpos[l] = 0;
+    }
+
+    int pos = 0;
+    for (struct list_head *node = head->next; node != head;
+         node = node->next) {
+        pos++;
+        int h = skip_height();
+        if (!h)
+            continue;
+
+        skip_tower_t *t = tower_new(node, h);
+        if (!t) {
+            skiplist_free(s);
+            return NULL;
+        }
+        for (int l = 0; l < h; l++) {
+            last[l][l].next = t;
+            last[l][l].width = pos - lastpos[l];
+            last[l] = t->link;
+            lastpos[l] = pos;
+        }
+    }
+
+    for (int l = 0; l < SKIP_LEVELS; l++)
+        last[l][l].width = size + 1 - lastpos[l];
+    return s;
+}
+
+void skiplist_free(skiplist_t *s)
+{
+    if (!s)
+        return;
+
+    /* Every tower has a link on level 1 */
+    for (skip_tower_t *t = s->head[0].next, *next; t; t = next) {
+        next = t->link[0].next;
+        free(t);
+    }
+    free(s);
+}
+
+struct list_head *skiplist_at(skiplist_t *s,
+                              struct list_head *head,
+                              int i)
+{
+    return skip_find(s, head, i + 1, NULL, NULL);
+}
+
+void skiplist_insert(skiplist_t *s, struct list_head *head, int i)
+{
+    skip_link_t *update[SKIP_LEVELS];
+    int upos[SKIP_LEVELS];
+
+    /* The nodes before the new one keep their positions */
+    int pos = i + 1;
+    struct list_head *node = skip_find(s, head, pos - 1, update, upos)->next;
+
+    int h = skip_height();
+    skip_tower_t *t = h ? tower_new(node, h) : NULL;
+    if (!t)
+        h = 0;
+
+    /* The links over the new node get one node longer, except those it
+     * splits in two
+     */
+    for (int l = 0; l < SKIP_LEVELS; l++) {
+        skip_link_t *u = &update[l][l];
+        if (l < h) {
+            t->link[l].next = u->next;
+            t->link[l].width = upos[l] + u->width + 1 - pos;
+            u->next = t;
+            u->width = pos - upos[l];
+        } else {
+            u->width++;
+        }
+    }
+}
+
+struct list_head *skiplist_remove(skiplist_t *s, struct list_head *head, int i)
+{
+    skip_link_t *update[SKIP_LEVELS];
+    int upos[SKIP_LEVELS];
+
+    int pos = i + 1;
+    struct list_head *node = skip_find(s, head, pos - 1, update, upos)->next;
+
+    /* The links over the node get one node shorter, and those reaching its
+     * tower are joined with the links leaving it
+     */
+    skip_tower_t *t = NULL;
+    for (int l = 0; l < SKIP_LEVELS; l++) {
+        skip_link_t *u = &update[l][l];
+        if (u->next && upos[l] + u->width == pos) {
+            t = u->next;
+            u->width += t->link[l].width - 1;
+            u->next = t->link[l].next;
+        } else {
+            u->width--;
+        }
+    }
+    free(t);
+    return node;
+}
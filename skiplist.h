@@ -0,0 +1,74 @@
+#ifndef LAB0_SKIPLIST_H
+#define LAB0_SKIPLIST_H
+
+/* Order-statistic skip list over a circular doubly-linked list
+ *
+ * The index does not own the list: its bottom level is the list itself, and
+ * the upper levels are towers built over some of the nodes, each link of
+ * which records how many nodes it skips. Finding the node at a position
+ * then takes O(log n) expected time instead of a walk along the list.
+ *
+ * The list may only change through skiplist_insert() and skiplist_remove()
+ * while the index is in use. Any other relinking requires a new index.
+ *
+ * Towers are allocated through the harness.
+ */
+
+#include "list.h"
+
+typedef struct skiplist skiplist_t;
+
+/**
+ * skiplist_new() - Build the index of a list
+ * @head: header of the list
+ * @size: number of nodes of the list
+ *
+ * Takes O(@size) time.
+ *
+ * Return: the index, or NULL if allocation failed
+ */
+skiplist_t *skiplist_new(struct list_head *head, int size);
+
+/**
+ * skiplist_free() - Free an index, leaving its list alone
+ * @s: the index, or NULL
+ */
+void skiplist_free(skiplist_t *s);
+
+/**
+ * skiplist_at() - Find the node at a position
+ * @s: index of the list
+ * @head: header of the list
+ * @i: position, from 0 for the first node to the size of the list minus 1
+ *
+ * @i may also be -1, for which @head is returned.
+ *
+ * Return: the node
+ */
+struct list_head *skiplist_at(skiplist_t *s,
+                              struct list_head *head,
+                              int i);
+
+/**
+ * skiplist_insert() - Index a node linked into the list
+ * @s: index of the list
+ * @head: header of the list
+ * @i: position of the new node
+ *
+ * The node must already follow the node at position @i - 1, the others
+ * keeping their order. If no tower can be allocated for the new node, it is
+ * indexed without one, which leaves the index correct if less balanced.
+ */
+void skiplist_insert(skiplist_t *s, struct list_head *head, int i);
+
+/**
+ * skiplist_remove() - Unindex the node at a position
+ * @s: index of the list
+ * @head: header of the list
+ * @i: position of the node
+ *
+ * Return: the node, which the caller then unlinks from the list
+ */
+struct list_head *skiplist_remove(skiplist_t *s, struct list_head *head, int i);
+
+#endif /* LAB0_SKIPLIST_H */
@@ -0,0 +1,23 @@
+# Compare duplicate elimination on 1,000,000 unsorted strings
+# Mostly distinct random strings, plus two heavily repeated ones
+option fail 0
+option malloc 0
+option time 60
+option verbose 2
+# Hash-based, on the queue as it is
+new
+ih RAND 600000
+ih dolphin 200000
+it gerbil 200000
+dedupu
+size
+free
+# Sort first, then delete adjacent duplicates
+new
+ih RAND 600000
+ih dolphin 200000
+it gerbil 200000
+time sort
+time dedup
+size
+free
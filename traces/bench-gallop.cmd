@@ -0,0 +1,39 @@
+# Compare merges one node at a time with galloping merges, on queues whose
+# runs barely overlap
+option fail 0
+option malloc 0
+option time 60
+# Two sorted halves of random strings, then 1% random strings appended
+new
+ih RAND 500000
+sort
+it RAND 500000
+option gallop 0
+bench
+option gallop 1
+bench
+it RAND 10000
+option gallop 0
+bench
+option gallop 1
+bench
+free
+# Queues covering disjoint ranges of strings
+new
+ih apple 200000
+new
+ih banana 200000
+new
+ih cherry 200000
+option gallop 0
+merge
+free
+new
+ih apple 200000
+new
+ih banana 200000
+new
+ih cherry 200000
+option gallop 1
+merge
+free
@@ -0,0 +1,28 @@
+# Positional access in a 2,000,000-element queue, walking the queue and
+# then through the skip list index
+option fail 0
+option malloc 0
+option time 60
+new
+ih RAND 2000000
+time delat 1000000
+time delat 700000
+time range 1500000 1500010
+option index 1
+# Building the index walks the queue once
+time at 1000000
+time delat 1000000
+time delat 700000
+time range 1500000 1500010
+# Insertions and removals at the ends keep the index
+it RAND 1000
+rh
+rt
+time delat 1000000
+time dm
+time at 1000000
+# Other operations leave it to be rebuilt
+reverse
+time at 1000000
+time at 1000000
+free
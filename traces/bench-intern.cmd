@@ -0,0 +1,20 @@
+# Compare the memory taken by a duplicate-heavy queue, as in trace-14, with
+# and without interning
+option fail 0
+option malloc 0
+option time 60
+# One copy of the string per element
+new
+ih dolphin 1000000
+it gerbil 1000000
+mem
+free
+mem
+# Elements sharing two interned strings
+option intern 1
+new
+ih dolphin 1000000
+it gerbil 1000000
+mem
+free
+mem
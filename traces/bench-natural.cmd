@@ -0,0 +1,30 @@
+# Compare sorting algorithms on presorted 1,000,000-element queues, where the
+# natural merge sort does close to one comparison per element
+option fail 0
+option malloc 0
+option time 60
+new
+ih RAND 1000000
+sort
+# Sorted
+bench
+# Reverse-sorted
+reverse
+bench
+reverse
+# Nearly sorted: neighbors swapped pairwise
+swap
+bench
+swap
+# Nearly sorted: 1% random strings appended
+it RAND 10000
+bench
+free
+# Sorted with runs of duplicates, as in trace-14
+new
+ih dolphin 500000
+it gerbil 500000
+bench
+reverse
+bench
+free
@@ -0,0 +1,10 @@
+# Compare walks with and without prefetching over 2,000,000 elements linked in
+# shuffled memory order, computing the entropy of every string as show does
+option fail 0
+option malloc 0
+option time 60
+new
+ih RAND 2000000
+walk
+walk
+free
@@ -0,0 +1,15 @@
+# Rebalance 1,000,000 elements between queues by relinking them, which
+# neither copies strings nor allocates elements
+option fail 0
+option malloc 0
+option time 60
+new
+ih RAND 1000000
+time split 250000
+time concat 0
+time split 500000
+time splice
+size
+free
+free
+free
@@ -0,0 +1,14 @@
+# Drain 1,000,000 elements from either end in batches of growing sizes
+option fail 0
+option malloc 0
+option time 60
+new
+it RAND 1000000
+time rh * 1
+time rh * 1000
+time rt * 1000
+time rh * 100000
+time rt * 100000
+time rh * 798999
+size
+free
@@ -0,0 +1,33 @@
+# Compare sorting algorithms on random strings
+# 10000, 50000 and 100000: the sizes used by trace-15
+# 1000000: large enough for the data to fall out of cache
+option fail 0
+option malloc 0
+option time 60
+new
+ih RAND 10000
+bench
+free
+new
+ih RAND 50000
+bench
+free
+new
+ih RAND 100000
+bench
+free
+new
+ih RAND 1000000
+bench
+# Reverse-sorted input
+sort
+reverse
+bench
+free
+# Duplicate-heavy input, as in trace-14
+new
+ih dolphin 500000
+it gerbil 500000
+reverse
+bench
+free
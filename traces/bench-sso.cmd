@@ -0,0 +1,19 @@
+# Compare 1,000,000 random strings of 5 to 9 characters stored inline with
+# their elements and in blocks of their own
+option fail 0
+option malloc 0
+option time 60
+# Short strings inline, the default
+new
+ih RAND 1000000
+mem
+time sort
+free
+mem
+# Every string in a block of its own
+option sso 0
+new
+ih RAND 1000000
+mem
+time sort
+free
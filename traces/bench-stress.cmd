@@ -0,0 +1,24 @@
+# Pass 1,000,000 elements through each concurrent queue with 2 to 32 threads,
+# half of them producers: lock-free, two locks, then one lock around the q_*
+# functions of the backend
+option fail 0
+option malloc 0
+option time 60
+option cqueue 0
+stress 1 1 1000000
+stress 2 2 1000000
+stress 4 4 1000000
+stress 8 8 1000000
+stress 16 16 1000000
+option cqueue 1
+stress 1 1 1000000
+stress 2 2 1000000
+stress 4 4 1000000
+stress 8 8 1000000
+stress 16 16 1000000
+option cqueue 2
+stress 1 1 1000000
+stress 2 2 1000000
+stress 4 4 1000000
+stress 8 8 1000000
+stress 16 16 1000000
@@ -0,0 +1,110 @@
+/* Two-lock multi-producer multi-consumer queue
+ *
+ * The algorithm is the blocking one of M. M. Michael and M. L. Scott,
+ * "Simple, Fast, and Practical Non-Blocking and Blocking Concurrent Queue
+ * Algorithms" (PODC 1996). Elements form a singly-linked chain through
+ * list.next, ending with NULL, whose first node is a dummy. The tail lock
+ * guards the link of the last node and the tail; the head lock guards the
+ * head. Since the dummy always separates them, the only node both sides may
+ * touch at once is a dummy that is also the last node, and then only its
+ * link, which is accessed atomically.
+ *
+ * A removal copies the string of the node following the dummy and makes
+ * that node the new dummy, so the element of a removed string is released
+ * by the next removal. The first dummy is a list_head inside the queue.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "element.h"
+#include "twolock.h"
+
+/* Bytes between the head and tail locks, so that producers and consumers
+ * do not invalidate each other's cache line
+ */
+#define CACHE_LINE 64
+
+struct twolock {
+    struct list_head *head;
+    pthread_mutex_t head_lock;
+    char pad[CACHE_LINE];
+    struct list_head *tail;
+    pthread_mutex_t tail_lock;
+    struct list_head stub;
+};
+
+/* Release the element of node, unless it is the first dummy of q */
+static void release_node(twolock_t *q, struct list_head *node)
+{
+    if (node != &q->stub)
+        q_release_element(list_entry(node, element_t, list));
+}
+
+twolock_t *twolock_new(void)
+{
+    twolock_t *q = malloc(sizeof(twolock_t));
+    if (!q)
+        return NULL;
+
+    q->stub.next = NULL;
+    q->head = q->tail = &q->stub;
+    pthread_mutex_init(&q->head_lock, NULL);
+    pthread_mutex_init(&q->tail_lock, NULL);
+    return q;
+}
+
+void twolock_free(twolock_t *q)
+{
+    if (!q)
+        return;
+
+    for (struct list_head *node = q->head, *next; node; node = next) {
+        next = node->next;
+        release_node(q, node);
+    }
+    pthread_mutex_destroy(&q->head_lock);
+    pthread_mutex_destroy(&q->tail_lock);
+    free(q);
+}
+
+bool twolock_insert_tail(twolock_t *q, char *s)
+{
+    if (!q || !s)
+        return false;
+
+    element_t *e = element_new(s);
+    if (!e)
+        return false;
+    e->list.next = NULL;
+
+    /* Release pairs with the acquire of a removal reading the link, which
+     * may happen under the head lock alone
+     */
+    pthread_mutex_lock(&q->tail_lock);
+    __atomic_store_n(&q->tail->next, &e->list, __ATOMIC_RELEASE);
+    q->tail = &e->list;
+    pthread_mutex_unlock(&q->tail_lock);
+    return true;
+}
+
+bool twolock_remove_head(twolock_t *q, char *sp, size_t bufsize)
+{
+    if (!q)
+        return false;
+
+    pthread_mutex_lock(&q->head_lock);
+    struct list_head *dummy = q->head;
+    struct list_head *first = __atomic_load_n(&dummy->next, __ATOMIC_ACQUIRE);
+    if (!first) {
+        pthread_mutex_unlock(&q->head_lock);
+        return false;
+    }
+    element_copy_value(list_entry(first, element_t, list), sp, bufsize);
+    q->head = first;
+    pthread_mutex_unlock(&q->head_lock);
+
+    /* No producer links to dummy any more: it was not the last node */
+    release_node(q, dummy);
+    return true;
+}
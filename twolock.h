@@ -0,0 +1,60 @@
+#ifndef LAB0_TWOLOCK_H
+#define LAB0_TWOLOCK_H
+
+/* Two-lock multi-producer multi-consumer queue
+ *
+ * The blocking queue of M. M. Michael and M. L. Scott, built from element_t
+ * linked through their list_head. Insertions at the tail and removals from
+ * the head take separate mutexes, so one producer and one consumer never
+ * wait for each other; producers wait for producers and consumers for
+ * consumers.
+ *
+ * Allocation goes through the harness, which must be in threaded mode
+ * while several threads use a queue. Interning (q_intern) is not supported.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct twolock twolock_t;
+
+/**
+ * twolock_new() - Create an empty queue
+ *
+ * Return: the new queue, or NULL if allocation failed
+ */
+twolock_t *twolock_new(void);
+
+/**
+ * twolock_free() - Free a queue along with the elements it still holds
+ * @q: queue no thread uses any more, or NULL
+ */
+void twolock_free(twolock_t *q);
+
+/**
+ * twolock_insert_tail() - Insert an element at tail of queue, like
+ * q_insert_tail()
+ * @q: the queue
+ * @s: string to be copied into the new element
+ *
+ * Return: true for success, false for allocation failure or NULL @s
+ */
+bool twolock_insert_tail(twolock_t *q, char *s);
+
+/**
+ * twolock_remove_head() - Remove the string at head of queue
+ * @q: the queue
+ * @sp: buffer receiving a copy of the removed string, or NULL
+ * @bufsize: size of @sp
+ *
+ * Unlike q_remove_head(), no element is returned: the element holding the
+ * string stays in the queue as its new dummy, and the element of the
+ * previous removal is released instead.
+ *
+ * Return: true for success, false if the queue was empty
+ */
+bool twolock_remove_head(twolock_t *q, char *sp, size_t bufsize);
+
+#endif /* LAB0_TWOLOCK_H */